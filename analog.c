@@ -0,0 +1,235 @@
+#include "analog.h"
+
+#include <avr/interrupt.h>
+#include <avr/pgmspace.h>
+
+#include "key_stats.h"
+#include "timer.h"
+
+#if MATRIX_ANALOG
+
+#if ANALOG_SCRIPT
+#include "analog_script.h"
+#endif
+
+// The rest value follows readings this close above it, so it tracks the
+// slow drift of the sensors with temperature
+#define REST_TRACKING 4
+
+analog_key_t analog_keys[NUM_KEYS];
+
+static const uint8_t row_channels[NUM_ROWS] = ANALOG_ROW_CHANNELS;
+
+// The ADC interrupt fills one buffer while analog_scan() processes the other
+static uint16_t samples[2][NUM_KEYS];
+static uint8_t sweep_buffer = 0;
+static volatile bool sweeping = false;
+static uint8_t sweep_key;
+static uint8_t sweep_col;
+static uint8_t sweep_row;
+static bool settling;
+
+#if ANALOG_SCRIPT
+static uint16_t script_values[NUM_KEYS];
+static uint8_t script_step = 0;
+
+static void play_script() {
+    const uint32_t now = timer_millis();
+    while (script_step < sizeof(analog_script) / sizeof(analog_script[0]) &&
+           pgm_read_word(&analog_script[script_step].ms) <= now) {
+        const uint8_t key = pgm_read_byte(&analog_script[script_step].key);
+        script_values[key] = pgm_read_word(&analog_script[script_step].value);
+        script_step++;
+    }
+}
+#endif
+
+__attribute__((always_inline)) static inline void select_channel(
+    uint8_t channel) {
+    // ADC8-13 are selected with MUX5, which lives in ADCSRB
+    ADCSRB = (channel & 0x08) ? (1 << MUX5) : 0;
+    ADMUX = (1 << REFS0) | (channel & 0x07);  // AVcc reference
+}
+
+static void start_sweep() {
+    sweep_key = 0;
+    sweep_col = 0;
+    sweep_row = 0;
+    set_high(col_pins[0]);
+    select_channel(row_channels[0]);
+    settling = true;
+    sweeping = true;
+    ADCSRA |= (1 << ADSC);
+}
+
+void analog_init() {
+    uint8_t didr0 = 0;
+    uint8_t didr2 = 0;
+    for (uint8_t j = 0; j < NUM_ROWS; j++) {
+        set_as_input(row_pins[j]);
+        // The digital input buffer only adds noise to an analog pin
+        if (row_channels[j] < 8) {
+            didr0 |= (1 << row_channels[j]);
+        } else {
+            didr2 |= (1 << (row_channels[j] - 8));
+        }
+    }
+    DIDR0 = didr0;
+    DIDR2 = didr2;
+
+    for (uint8_t k = 0; k < NUM_KEYS; k++) {
+        analog_keys[k].actuation = ANALOG_ACTUATION;
+    }
+#if ANALOG_SCRIPT
+    for (uint8_t k = 0; k < NUM_KEYS; k++) {
+        script_values[k] = ANALOG_SCRIPT_REST;
+    }
+#endif
+
+    // clk/64 = 250khz ADC clock, a conversion takes 13 ADC clocks (52us)
+    ADCSRA = (1 << ADEN) | (1 << ADIE) | (1 << ADPS2) | (1 << ADPS1);
+    start_sweep();
+}
+
+void analog_set_actuation(uint8_t key, uint8_t travel) {
+    if (key < NUM_KEYS && travel > ACTUATION_HYSTERESIS) {
+        analog_keys[key].actuation = travel;
+    }
+}
+
+// Updates the calibration and the travel of a key, returns whether the key
+// is pressed
+static bool process_key(analog_key_t *key, uint16_t value) {
+#if !ANALOG_PRESS_RISES
+    value = 1023 - value;
+#endif
+
+    if (!(key->flags & ANALOG_CALIBRATED)) {
+        key->rest = value;
+        key->bottom = value + ANALOG_MIN_RANGE;
+        key->flags |= ANALOG_CALIBRATED;
+    }
+
+    if (value < key->rest) {
+        key->rest = value;
+    } else if (!(key->flags & ANALOG_PRESSED) &&
+               value - key->rest <= REST_TRACKING && value > key->rest) {
+        key->rest++;
+    }
+    if (key->bottom < key->rest + ANALOG_MIN_RANGE) {
+        key->bottom = key->rest + ANALOG_MIN_RANGE;
+    }
+    if (value > key->bottom) {
+        key->bottom = value;
+    }
+
+    // 256 * (value - rest) / (bottom - rest) without leaving 16 bits, the
+    // ADC only has 10 and the range is at least ANALOG_MIN_RANGE
+    const uint16_t travel =
+        ((value - key->rest) << 6) / ((key->bottom - key->rest) >> 2);
+    key->travel = travel > 255 ? 255 : travel;
+
+    const uint8_t t = key->travel;
+    const bool at_rest = t + ACTUATION_HYSTERESIS < key->actuation;
+    if (key->flags & ANALOG_PRESSED) {
+        if (t > key->extreme) {
+            key->extreme = t;
+        }
+        if (at_rest) {
+            key->flags &= ~(ANALOG_PRESSED | ANALOG_RT_ARMED);
+#if ANALOG_RAPID_TRIGGER
+        } else if (t + ANALOG_RAPID_TRIGGER <= key->extreme) {
+            // Moving up, release without waiting for the actuation point
+            key->flags &= ~ANALOG_PRESSED;
+            key->flags |= ANALOG_RT_ARMED;
+            key->extreme = t;
+#endif
+        }
+    } else if (key->flags & ANALOG_RT_ARMED) {
+        if (t < key->extreme) {
+            key->extreme = t;
+        }
+        if (at_rest) {
+            key->flags &= ~ANALOG_RT_ARMED;
+        } else if (t >= key->extreme + ANALOG_RAPID_TRIGGER) {
+            // Moving down again, press without going back up first
+            key->flags |= ANALOG_PRESSED;
+            key->extreme = t;
+        }
+    } else if (t >= key->actuation) {
+        key->flags |= ANALOG_PRESSED;
+        key->extreme = t;
+    }
+    return key->flags & ANALOG_PRESSED;
+}
+
+bool analog_scan() {
+    if (sweeping) {
+        return false;
+    }
+
+    const uint16_t *values = samples[sweep_buffer];
+    sweep_buffer ^= 1;
+#if ANALOG_SCRIPT
+    play_script();
+#endif
+    start_sweep();
+
+    bool changed = false;
+    bool idle = true;
+    uint8_t k = 0;
+    for (uint8_t i = 0; i < NUM_COLS; i++) {
+        matrix_rows_t rows = 0;
+        for (uint8_t j = 0; j < NUM_ROWS; j++, k++) {
+            if (process_key(&analog_keys[k], values[k])) {
+                rows |= ROW_BIT(j);
+            }
+            if (analog_keys[k].travel >= ACTUATION_HYSTERESIS) {
+                idle = false;
+            }
+        }
+
+        if (rows != matrix_state[i]) {
+#if KEY_STATS
+            key_stats_count_presses(i, rows & ~matrix_state[i]);
+#endif
+            matrix_state[i] = rows;
+            changed = true;
+        }
+    }
+    matrix_idle = idle;
+    return changed;
+}
+
+// Stores the finished conversion and starts the next one. The first
+// conversion after switching columns is thrown away, it gives the sensors of
+// the newly powered column time to settle.
+ISR(ADC_vect) {
+    if (settling) {
+        settling = false;
+        ADCSRA |= (1 << ADSC);
+        return;
+    }
+
+#if ANALOG_SCRIPT
+    samples[sweep_buffer][sweep_key] = script_values[sweep_key];
+#else
+    samples[sweep_buffer][sweep_key] = ADC;
+#endif
+    sweep_key++;
+
+    if (++sweep_row == NUM_ROWS) {
+        sweep_row = 0;
+        set_low(col_pins[sweep_col]);
+        if (++sweep_col == NUM_COLS) {
+            sweeping = false;
+            return;
+        }
+        set_high(col_pins[sweep_col]);
+        settling = true;
+    }
+    select_channel(row_channels[sweep_row]);
+    ADCSRA |= (1 << ADSC);
+}
+
+#endif  // MATRIX_ANALOG
@@ -0,0 +1,41 @@
+#ifndef ANALOG_H
+#define ANALOG_H
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "matrix.h"
+
+// Sensor state of a single analog key, keys are indexed by
+// col * NUM_ROWS + row
+typedef struct {
+    uint16_t rest;       // ADC reading with the key released
+    uint16_t bottom;     // Deepest ADC reading seen so far
+    uint8_t travel;      // 0 (released) - 255 (bottomed out)
+    uint8_t actuation;   // Travel at which the key registers
+    uint8_t extreme;     // Deepest travel while pressed, highest travel
+                         // while rapid trigger is armed
+    uint8_t flags;
+} __attribute__((packed)) analog_key_t;
+
+// analog_key_t flags
+#define ANALOG_CALIBRATED (1 << 0)
+#define ANALOG_PRESSED (1 << 1)
+#define ANALOG_RT_ARMED (1 << 2)  // Released by rapid trigger, pressed again
+                                  // on the way down
+
+// A key is back at rest once it is this far above its actuation point,
+// keeps sensor noise around the actuation point from chattering
+#define ACTUATION_HYSTERESIS 8
+
+extern analog_key_t analog_keys[NUM_KEYS];
+
+void analog_init();
+// Processes the last complete sweep of the sensors and starts the next one,
+// so the conversions run while the keys are processed. Updates matrix_state
+// and matrix_idle, returns true if a key changed. Returns false right away
+// while the first sweep is still running.
+bool analog_scan();
+// The travel has to be above ACTUATION_HYSTERESIS, other values are ignored
+void analog_set_actuation(uint8_t key, uint8_t travel);
+
+#endif
@@ -0,0 +1,45 @@
+#ifndef ANALOG_SCRIPT_H
+#define ANALOG_SCRIPT_H
+#include <avr/pgmspace.h>
+#include <stdint.h>
+
+// Simulated sensor readings used with ANALOG_SCRIPT. From ms after boot on,
+// the sensor of key reads value. Keys not mentioned read ANALOG_SCRIPT_REST.
+// Steps must be sorted by time.
+typedef struct {
+    uint16_t ms;
+    uint8_t key;
+    uint16_t value;
+} analog_step_t;
+
+#define ANALOG_SCRIPT_REST 300
+
+static const analog_step_t analog_script[] PROGMEM = {
+    // Key 0: slow press down to the bottom and release
+    {1000, 0, 350},
+    {1010, 0, 400},  // actuates
+    {1020, 0, 450},
+    {1030, 0, 500},
+    {1040, 0, 550},
+    {1100, 0, 400},
+    {1110, 0, 300},
+    // Key 2: rapid trigger, wiggles deep below the actuation point
+    {2000, 2, 450},  // pressed
+    {2010, 2, 600},
+    {2020, 2, 560},  // released by moving up
+    {2030, 2, 600},  // pressed again by moving down
+    {2040, 2, 560},  // released
+    {2050, 2, 300},
+    // Keys 5 and 7 together, the TAB combo
+    {3000, 5, 600},
+    {3000, 7, 600},
+    {3100, 5, 300},
+    {3100, 7, 300},
+    // Sensor drift, key 4 at rest creeps up and must not actuate
+    {4000, 4, 302},
+    {4100, 4, 304},
+    {4200, 4, 306},
+    {4300, 4, 308},
+};
+
+#endif
@@ -7,16 +7,35 @@
 #include <avr/interrupt.h>
 #include <avr/io.h>
 #include <avr/pgmspace.h>
+#include <string.h>
 #include <util/delay.h>
 
+#include "analog.h"
+#include "combo.h"
+#include "console.h"
 #include "descriptors.h"
 #include "endpoints.h"
+#include "key_stats.h"
 #include "keys.h"
+#include "leds.h"
+#include "matrix.h"
+#include "memory.h"
+#include "mousekey.h"
+#include "profile.h"
+#include "ps2.h"
+#include "report.h"
+#include "rgb.h"
+#include "scan_rate.h"
+#include "sched.h"
+#include "timer.h"
 
 bool using_report_protocol = true;
 uint8_t current_configuration = 0;
 uint16_t keyboard_idle_duration = 500;
-uint16_t keyboard_idle_remaining = 0;
+uint16_t keyboard_last_report = 0;
+// report_seq of the last report sent on the interrupt endpoint
+uint8_t keyboard_sent_seq = 0;
+uint32_t boot_times[BOOT_MILESTONES];
 
 enum USB_DEVICE_STATE {
     DEFAULT,
@@ -26,23 +45,47 @@ enum USB_DEVICE_STATE {
 
 enum USB_DEVICE_STATE usb_device_state = DEFAULT;
 
-static void handle_standard_request(SetupRequest_t *request);
-static void handle_hid_request(SetupRequest_t *request);
+static void dispatch_request(SetupRequest_t *request);
+static void acknowledge_request(SetupRequest_t *request);
 
 static void usb_device_get_status(SetupRequest_t *request);
 static void usb_device_set_address(SetupRequest_t *request);
 static void usb_device_get_descriptor(SetupRequest_t *request);
 static void usb_device_get_configuration(SetupRequest_t *request);
 static void usb_device_set_configuration(SetupRequest_t *request);
+static void usb_device_get_interface(SetupRequest_t *request);
+static void hid_get_keyboard_report(SetupRequest_t *request);
+static void hid_get_mouse_report(SetupRequest_t *request);
+static void hid_set_keyboard_report(SetupRequest_t *request);
 static void hid_get_idle(SetupRequest_t *request);
 static void hid_set_idle(SetupRequest_t *request);
+static void hid_get_mouse_idle(SetupRequest_t *request);
 static void hid_get_protocol(SetupRequest_t *request);
 static void hid_set_protocol(SetupRequest_t *request);
 
+static void vendor_get_key_stats(SetupRequest_t *request);
+static void vendor_reset_key_stats(SetupRequest_t *request);
+static void vendor_get_boot_times(SetupRequest_t *request);
+static void vendor_get_task_stats(SetupRequest_t *request);
+static void vendor_reset_task_stats(SetupRequest_t *request);
+static void vendor_get_scan_rates(SetupRequest_t *request);
+static void vendor_get_memory(SetupRequest_t *request);
+#if MATRIX_ANALOG
+static void vendor_get_analog_keys(SetupRequest_t *request);
+static void vendor_set_actuation(SetupRequest_t *request);
+#endif
+#if PROFILE
+static void vendor_get_profile(SetupRequest_t *request);
+static void vendor_reset_profile(SetupRequest_t *request);
+#endif
+
+static void send_control_data(SetupRequest_t *request, const uint8_t *data,
+                              uint16_t length);
 static void send_report();
+static void send_mouse_report();
+static void receive_led_report();
 
-void usb_init() {
-    cli();
+void usb_enable_pll() {
     // Enable pads regulator
     UHWCON |= (1 << UVREGE);
 
@@ -50,8 +93,13 @@ void usb_init() {
     // which is used as the source for the USB clock
     // (Should work even w/o setting the prescaler)
     PLLCSR |= (1 << PINDIV) | (1 << PLLE);
+}
+
+void usb_init() {
+    cli();
     while (!(PLLCSR & (1 << PLOCK))) {
     }  // Wait for the clock to settle
+    boot_times[BOOT_PLL_LOCK] = timer_now_us();
 
     // Enable VBUS pad & the USB CONTROLLER itself
     USBCON |= (1 << USBE) | (1 << OTGPADE);
@@ -71,213 +119,354 @@ void usb_init() {
 }
 
 int main(void) {
+    timer_init();
+    sei();
+    boot_times[BOOT_RESET] = timer_now_us();
+
+    // Get the PLL going first, the rest of the initialization runs while
+    // it locks
+    usb_enable_pll();
+    init_pins();
+    leds_init();
+    rgb_init();
+    ps2_init();
+    combo_init();
+    key_stats_init();
     usb_init();
+
+    // The host waits at least 100ms after we attach before it resets the bus
+    // so there is enough time to let the debounce settle on the initial state
+    // of the matrix before the first report is requested
+    for (uint8_t i = 0; i <= DEBOUNCE_SCANS; i++) {
+        matrix_scan();
+    }
+
+    // The report is sent from the SOF interrupt as soon as it changes
+    sched_init();
     while (1) {
-        // if (usb_device_state == CONFIGURED) {
-        //     UENUM = 1;
-        //     if ((keyboard_idle_remaining == 0) &&
-        //         endpoint_is_read_write_allowed()) {
-        //         send_report();
-        //         keyboard_idle_remaining = keyboard_idle_duration;
-        //     }
-        // }
+        sched_run();
     }
 }
 
 ISR(USB_GEN_vect) {
+    PROFILE_START(PROFILE_USB_GEN);
     if (UDINT & (1 << EORSTI)) {
         UDINT &= ~(1 << EORSTI);
+        boot_times[BOOT_BUS_RESET] = timer_now_us();
         bool result = configure_control_endpoint();
     }
     if (UDINT & (1 << SOFI)) {
         UDINT &= ~(1 << SOFI);
+        const uint16_t now = timer_millis();
+        if (usb_device_state == CONFIGURED) {
+            timer_sync_to_sof();
+        }
+
         UENUM = 1;
-        if (keyboard_idle_remaining > 0) {
-            keyboard_idle_remaining--;
-        } else if ((keyboard_idle_remaining == 0) &&
-                   endpoint_is_read_write_allowed()) {
+        // An idle duration of 0 means the report is only sent when it
+        // changes (HID 1.11 Section 7.2.4)
+        const bool idle_expired =
+            (keyboard_idle_duration > 0) &&
+            ((uint16_t)(now - keyboard_last_report) >= keyboard_idle_duration);
+        if ((keyboard_sent_seq != report_seq || idle_expired) &&
+            endpoint_is_read_write_allowed()) {
             send_report();
-            keyboard_idle_remaining = keyboard_idle_duration;
+            keyboard_last_report = now;
+        }
+
+        // Mouse keys move every frame, after the keyboard so that they never
+        // delay a keyboard report. While the endpoint is busy the frame is
+        // skipped, so the motion waits instead of being computed and lost
+        // (the PS/2 movement keeps adding up meanwhile).
+        if (usb_device_state == CONFIGURED) {
+            select_mouse_endpoint();
+            if (endpoint_is_read_write_allowed()) {
+                bool send = mousekey_frame();
+#if PS2_MOUSE
+                if (ps2_mouse_frame(&mouse_report)) {
+                    send = true;
+                }
+#endif
+                if (send) {
+                    send_mouse_report();
+                }
+            }
         }
+#if DEBUG_CONSOLE
+        if (usb_device_state == CONFIGURED) {
+            console_flush();
+        }
+#endif
         UENUM = 0;
     }
+    PROFILE_END(PROFILE_USB_GEN);
 }
 
 ISR(USB_COM_vect) {
+#if CLOCK_SCALING
+    timer_clock_full();  // Answer control requests at full speed
+#endif
+    PROFILE_START(PROFILE_USB_COM);
+    if (UEINT & (1 << 2)) {
+        select_led_endpoint();
+        receive_led_report();
+    }
+
     UENUM = 0;
 
     if (is_setup_packet()) {
         SetupRequest_t request;
         read_setup_request(&request);
 
-        handle_hid_request(&request);
-        if (!is_setup_packet()) {
-            return;
-        }
-        handle_standard_request(&request);
+        dispatch_request(&request);
     }
 
     // If the RXSTPI flag is still set, it means that the request was not
-    // recognized so we stall the endpoint. There is no need to clear the stall
-    // (STALLRQC), the hardware does it automatically before the next SETUP
-    // packet (see section 22.11.1 of the atmega32u4 datasheet).
+    // recognized (or its handler rejected it) so we stall the endpoint. There
+    // is no need to clear the stall (STALLRQC), the hardware does it
+    // automatically before the next SETUP packet (see section 22.11.1 of the
+    // atmega32u4 datasheet).
     if (is_setup_packet()) {
         clear_setup_flag();
         stall_request();
     }
+    PROFILE_END(PROFILE_USB_COM);
 }
 
-static void handle_standard_request(SetupRequest_t *request) {
-    const uint8_t bmRequestType = request->bmRequestType;
-    const uint8_t bRequest = request->bRequest;
+// Requests are looked up by (bmRequestType, bRequest). Requests addressed to
+// an interface are also routed by the interface number in wIndex, entries
+// with ANY_INTERFACE serve all of them. Anything not in the table is stalled,
+// including SET_INTERFACE (USB 2.0 Section 9.4.10: "If a device only
+// supports a default setting for the specified interface, then a STALL may be
+// returned in the Status stage of the request") and SYNCH_FRAME (there are no
+// isochronous endpoints).
+#define ANY_INTERFACE 0xFF
+
+#define STANDARD_IN(recipient) \
+    (REQDIR_DEVICETOHOST | REQTYPE_STANDARD | REQREC_##recipient)
+#define STANDARD_OUT(recipient) \
+    (REQDIR_HOSTTODEVICE | REQTYPE_STANDARD | REQREC_##recipient)
+#define HID_IN (REQDIR_DEVICETOHOST | REQTYPE_CLASS | REQREC_INTERFACE)
+#define HID_OUT (REQDIR_HOSTTODEVICE | REQTYPE_CLASS | REQREC_INTERFACE)
+#define CDC_IN (REQDIR_DEVICETOHOST | REQTYPE_CLASS | REQREC_INTERFACE)
+#define CDC_OUT (REQDIR_HOSTTODEVICE | REQTYPE_CLASS | REQREC_INTERFACE)
+#define VENDOR_IN (REQDIR_DEVICETOHOST | REQTYPE_VENDOR | REQREC_DEVICE)
+#define VENDOR_OUT (REQDIR_HOSTTODEVICE | REQTYPE_VENDOR | REQREC_DEVICE)
+
+typedef void (*request_handler_t)(SetupRequest_t *request);
+
+typedef struct {
+    uint8_t bmRequestType;
+    uint8_t bRequest;
+    uint8_t interface;
+    request_handler_t handler;
+} request_entry_t;
+
+static const request_entry_t request_table[] PROGMEM = {
+    {STANDARD_IN(DEVICE), GET_STATUS, ANY_INTERFACE, usb_device_get_status},
+    {STANDARD_IN(INTERFACE), GET_STATUS, ANY_INTERFACE, usb_device_get_status},
+    {STANDARD_IN(ENDPOINT), GET_STATUS, ANY_INTERFACE, usb_device_get_status},
+    {STANDARD_OUT(DEVICE), SET_ADDRESS, ANY_INTERFACE, usb_device_set_address},
+    {STANDARD_IN(DEVICE), GET_DESCRIPTOR, ANY_INTERFACE,
+     usb_device_get_descriptor},
+    // Not in the USB 2.0 specification, but it is apparently needed for the
+    // HID class descriptors (LUFA also uses it,
+    // Drivers/USB/Core/DeviceStandardReq.c)
+    {STANDARD_IN(INTERFACE), GET_DESCRIPTOR, ANY_INTERFACE,
+     usb_device_get_descriptor},
+    {STANDARD_IN(DEVICE), GET_CONFIGURATION, ANY_INTERFACE,
+     usb_device_get_configuration},
+    {STANDARD_OUT(DEVICE), SET_CONFIGURATION, ANY_INTERFACE,
+     usb_device_set_configuration},
+    {STANDARD_IN(INTERFACE), GET_INTERFACE, ANY_INTERFACE,
+     usb_device_get_interface},
+    // Noop as we don't have any features
+    {STANDARD_OUT(DEVICE), CLEAR_FEATURE, ANY_INTERFACE, acknowledge_request},
+    {STANDARD_OUT(INTERFACE), CLEAR_FEATURE, ANY_INTERFACE,
+     acknowledge_request},
+    {STANDARD_OUT(ENDPOINT), CLEAR_FEATURE, ANY_INTERFACE,
+     acknowledge_request},
+    {STANDARD_OUT(DEVICE), SET_FEATURE, ANY_INTERFACE, acknowledge_request},
+    {STANDARD_OUT(INTERFACE), SET_FEATURE, ANY_INTERFACE, acknowledge_request},
+    {STANDARD_OUT(ENDPOINT), SET_FEATURE, ANY_INTERFACE, acknowledge_request},
+
+    {HID_IN, GET_REPORT, KEYBOARD_INTERFACE, hid_get_keyboard_report},
+    {HID_IN, GET_REPORT, MOUSE_INTERFACE, hid_get_mouse_report},
+    {HID_OUT, SET_REPORT, KEYBOARD_INTERFACE, hid_set_keyboard_report},
+    {HID_IN, GET_IDLE, KEYBOARD_INTERFACE, hid_get_idle},
+    {HID_OUT, SET_IDLE, KEYBOARD_INTERFACE, hid_set_idle},
+    // The mouse only reports motion, so its idle rate is always 0
+    {HID_IN, GET_IDLE, MOUSE_INTERFACE, hid_get_mouse_idle},
+    {HID_OUT, SET_IDLE, MOUSE_INTERFACE, acknowledge_request},
+    // Only the keyboard is a boot interface, the protocol requests to the
+    // other interfaces are stalled
+    {HID_IN, GET_PROTOCOL, KEYBOARD_INTERFACE, hid_get_protocol},
+    {HID_OUT, SET_PROTOCOL, KEYBOARD_INTERFACE, hid_set_protocol},
+
+#if DEBUG_CONSOLE
+    {CDC_OUT, SET_LINE_CODING, CONSOLE_INTERFACE, console_set_line_coding},
+    {CDC_IN, GET_LINE_CODING, CONSOLE_INTERFACE, console_get_line_coding},
+    {CDC_OUT, SET_CONTROL_LINE_STATE, CONSOLE_INTERFACE,
+     console_set_control_line_state},
+#endif
 
-    if (bRequest == GET_STATUS) {
-        if ((bmRequestType ==
-             (REQDIR_DEVICETOHOST | REQTYPE_STANDARD | REQREC_DEVICE)) ||
-            (bmRequestType ==
-             (REQDIR_DEVICETOHOST | REQTYPE_STANDARD | REQREC_INTERFACE)) ||
-            (bmRequestType ==
-             (REQDIR_DEVICETOHOST | REQTYPE_STANDARD | REQREC_ENDPOINT))) {
-            usb_device_get_status(request);
-        }
-    } else if (bRequest == SET_ADDRESS) {
-        if (bmRequestType ==
-            (REQDIR_HOSTTODEVICE | REQTYPE_STANDARD | REQREC_DEVICE)) {
-            usb_device_set_address(request);
-        }
-    } else if (bRequest == GET_DESCRIPTOR) {
-        if ((bmRequestType ==
-             (REQDIR_DEVICETOHOST | REQTYPE_STANDARD | REQREC_DEVICE)) ||
-            (bmRequestType ==
-             (REQDIR_DEVICETOHOST | REQTYPE_STANDARD | REQREC_INTERFACE))) {
-            // The last bmRequestType type is not in the USB 2.0 specification,
-            // but it is apparently needed (LUFA also uses it,
-            // Drivers/USB/Core/DeviceStandardReq.c)
-            usb_device_get_descriptor(request);
-        }
-    } else if (bRequest == GET_CONFIGURATION) {
-        if (bmRequestType ==
-            (REQDIR_DEVICETOHOST | REQTYPE_STANDARD | REQREC_DEVICE)) {
-            usb_device_get_configuration(request);
-        }
-    } else if (bRequest == SET_CONFIGURATION) {
-        if (bmRequestType ==
-            (REQDIR_HOSTTODEVICE | REQTYPE_STANDARD | REQREC_DEVICE)) {
-            usb_device_set_configuration(request);
-        }
-    } else if (bRequest == GET_INTERFACE) {
-        if (bmRequestType ==
-            (REQDIR_DEVICETOHOST | REQTYPE_STANDARD | REQREC_INTERFACE)) {
-            // We don't support alternate settings..
-            clear_setup_flag();
-            write_byte(0);
-            clear_in_flag();
-            clear_status_stage(request->bmRequestType);
-        }
-    } else if (bRequest == SET_INTERFACE) {
-        if (bmRequestType ==
-            (REQDIR_HOSTTODEVICE | REQTYPE_STANDARD | REQREC_INTERFACE)) {
-            // USB 2.0 Section 9.4.10: "If a device only supports a default
-            // setting for the specified interface, then a STALL may be returned
-            // in the Status stage of the request"
-        }
-    } else if (bRequest == CLEAR_FEATURE) {
-        if ((bmRequestType ==
-             (REQDIR_HOSTTODEVICE | REQTYPE_STANDARD | REQREC_DEVICE)) ||
-            (bmRequestType ==
-             (REQDIR_HOSTTODEVICE | REQTYPE_STANDARD | REQREC_INTERFACE)) ||
-            (bmRequestType ==
-             (REQDIR_HOSTTODEVICE | REQTYPE_STANDARD | REQREC_ENDPOINT))) {
-            // Noop as we don't have any features
-            clear_setup_flag();
-            clear_status_stage(request->bmRequestType);
-        }
-    } else if (bRequest == SET_FEATURE) {
-        if ((bmRequestType ==
-             (REQDIR_HOSTTODEVICE | REQTYPE_STANDARD | REQREC_DEVICE)) ||
-            (bmRequestType ==
-             (REQDIR_HOSTTODEVICE | REQTYPE_STANDARD | REQREC_INTERFACE)) ||
-            (bmRequestType ==
-             (REQDIR_HOSTTODEVICE | REQTYPE_STANDARD | REQREC_ENDPOINT))) {
-            // Noop as we don't have any features
-            clear_setup_flag();
-            clear_status_stage(request->bmRequestType);
+    {VENDOR_IN, VENDOR_GET_KEY_STATS, ANY_INTERFACE, vendor_get_key_stats},
+    {VENDOR_OUT, VENDOR_RESET_KEY_STATS, ANY_INTERFACE,
+     vendor_reset_key_stats},
+    {VENDOR_IN, VENDOR_GET_BOOT_TIMES, ANY_INTERFACE, vendor_get_boot_times},
+    {VENDOR_IN, VENDOR_GET_TASK_STATS, ANY_INTERFACE, vendor_get_task_stats},
+    {VENDOR_OUT, VENDOR_RESET_TASK_STATS, ANY_INTERFACE,
+     vendor_reset_task_stats},
+    {VENDOR_IN, VENDOR_GET_SCAN_RATES, ANY_INTERFACE, vendor_get_scan_rates},
+    {VENDOR_IN, VENDOR_GET_MEMORY, ANY_INTERFACE, vendor_get_memory},
+#if MATRIX_ANALOG
+    {VENDOR_IN, VENDOR_GET_ANALOG_KEYS, ANY_INTERFACE,
+     vendor_get_analog_keys},
+    {VENDOR_OUT, VENDOR_SET_ACTUATION, ANY_INTERFACE, vendor_set_actuation},
+#endif
+#if PROFILE
+    {VENDOR_IN, VENDOR_GET_PROFILE, ANY_INTERFACE, vendor_get_profile},
+    {VENDOR_OUT, VENDOR_RESET_PROFILE, ANY_INTERFACE, vendor_reset_profile},
+#endif
+};
+
+// Calls the handler of a request, an unknown request is left as is (with
+// RXSTPI set) for the caller to stall
+static void dispatch_request(SetupRequest_t *request) {
+    const uint8_t recipient = request->bmRequestType & 0x1F;
+    for (uint8_t i = 0; i < sizeof(request_table) / sizeof(request_table[0]);
+         i++) {
+        const request_entry_t *entry = &request_table[i];
+        if (pgm_read_byte(&entry->bmRequestType) != request->bmRequestType ||
+            pgm_read_byte(&entry->bRequest) != request->bRequest) {
+            continue;
         }
-    } else if (bRequest == SYNCH_FRAME) {
-        if (bmRequestType ==
-            (REQDIR_DEVICETOHOST | REQTYPE_STANDARD | REQREC_ENDPOINT)) {
-            // We don't use isochronous endpoints, so we don't need to
-            // handle this
-            return;
+
+        const uint8_t interface = pgm_read_byte(&entry->interface);
+        if (recipient == REQREC_INTERFACE && interface != ANY_INTERFACE &&
+            interface != (uint8_t)request->wIndex) {
+            continue;
         }
+
+        const request_handler_t handler =
+            (request_handler_t)pgm_read_ptr(&entry->handler);
+        handler(request);
+        return;
     }
 }
 
-static void handle_hid_request(SetupRequest_t *request) {
-    const uint8_t bmRequestType = request->bmRequestType;
-    const uint8_t bRequest = request->bRequest;
+static void acknowledge_request(SetupRequest_t *request) {
+    clear_setup_flag();
+    clear_status_stage(request->bmRequestType);
+}
 
-    if (bRequest == GET_PROTOCOL) {
-        if (bmRequestType ==
-            (REQDIR_DEVICETOHOST | REQTYPE_CLASS | REQREC_INTERFACE)) {
-            hid_get_protocol(request);
-        }
-    } else if (request->bRequest == GET_IDLE) {
-        if (bmRequestType ==
-            (REQDIR_DEVICETOHOST | REQTYPE_CLASS | REQREC_INTERFACE)) {
-            hid_get_idle(request);
-        }
-    } else if (request->bRequest == GET_REPORT) {
-        if (bmRequestType ==
-            (REQDIR_DEVICETOHOST | REQTYPE_CLASS | REQREC_INTERFACE)) {
-            clear_setup_flag();
-
-            write_byte(0);
-            write_byte(0);  // reserved
-            if (usb_device_state == CONFIGURED) {
-                write_byte(KEY_C);
-            } else if (usb_device_state == ADDRESSED) {
-                write_byte(KEY_A);
-            } else {
-                write_byte(KEY_D);
-            }
-            if (usb_device_state == CONFIGURED) {
-                write_byte(KEY_C);
-            } else if (usb_device_state == ADDRESSED) {
-                write_byte(KEY_A);
-            } else {
-                write_byte(KEY_D);
-            }
-            write_byte(0);
-            write_byte(0);
-            write_byte(0);
-            write_byte(0);
+static void usb_device_get_interface(SetupRequest_t *request) {
+    // We don't support alternate settings..
+    clear_setup_flag();
+    write_byte(0);
+    clear_in_flag();
+    clear_status_stage(request->bmRequestType);
+}
 
-            clear_in_flag();
-            clear_status_stage(request->bmRequestType);
-        }
-    } else if (request->bRequest == SET_PROTOCOL) {
-        if (bmRequestType ==
-            (REQDIR_HOSTTODEVICE | REQTYPE_CLASS | REQREC_INTERFACE)) {
-            hid_set_protocol(request);
-        }
-    } else if (request->bRequest == SET_IDLE) {
-        if (bmRequestType ==
-            (REQDIR_HOSTTODEVICE | REQTYPE_CLASS | REQREC_INTERFACE)) {
-            hid_set_idle(request);
-        }
-    } else if (request->bRequest == SET_REPORT) {
-        if (bmRequestType ==
-            (REQDIR_HOSTTODEVICE | REQTYPE_CLASS | REQREC_INTERFACE)) {
-            // our HID report has no output fields i.e. nothing can be set
-            // on the keyboard
-            clear_setup_flag();
-            clear_status_stage(request->bmRequestType);
-            return;
-        }
+static void hid_get_keyboard_report(SetupRequest_t *request) {
+    // The same snapshot the interrupt endpoint sends, boot protocol hosts
+    // (BIOS/UEFI) may poll it through here
+    send_control_data(request, (const uint8_t *)report_snapshot(),
+                      sizeof(keyboard_report_t));
+}
+
+static void hid_get_mouse_report(SetupRequest_t *request) {
+    send_control_data(request, (const uint8_t *)&mouse_report,
+                      sizeof(mouse_report));
+}
+
+static void hid_set_keyboard_report(SetupRequest_t *request) {
+    // The LEDs are normally set through the interrupt OUT endpoint, but hosts
+    // (and BIOSes in particular) may still send the output report through the
+    // control endpoint
+    clear_setup_flag();
+    if (request->wLength > 0) {
+        while (!(is_out_received()))
+            ;
+        leds_set(read_byte());
+        clear_out_flag();
     }
+    clear_status_stage(request->bmRequestType);
+}
+
+static void vendor_get_key_stats(SetupRequest_t *request) {
+    send_control_data(request, (const uint8_t *)key_stats, sizeof(key_stats));
+}
+
+static void vendor_reset_key_stats(SetupRequest_t *request) {
+    clear_setup_flag();
+    key_stats_reset();
+    clear_status_stage(request->bmRequestType);
+}
+
+static void vendor_get_boot_times(SetupRequest_t *request) {
+    send_control_data(request, (const uint8_t *)boot_times,
+                      sizeof(boot_times));
+}
+
+static void vendor_get_task_stats(SetupRequest_t *request) {
+    send_control_data(request, (const uint8_t *)task_stats,
+                      sizeof(task_stats));
 }
 
+static void vendor_reset_task_stats(SetupRequest_t *request) {
+    clear_setup_flag();
+    sched_reset_stats();
+    clear_status_stage(request->bmRequestType);
+}
+
+static void vendor_get_scan_rates(SetupRequest_t *request) {
+    // The number of rates and their periods, then the time spent at each
+    uint8_t data[1 + NUM_SCAN_RATES + sizeof(scan_rate_residency)];
+    data[0] = NUM_SCAN_RATES;
+    scan_rate_get_periods(&data[1]);
+    memcpy(&data[1 + NUM_SCAN_RATES], scan_rate_residency,
+           sizeof(scan_rate_residency));
+    send_control_data(request, data, sizeof(data));
+}
+
+static void vendor_get_memory(SetupRequest_t *request) {
+    memory_stats_t stats;
+    memory_get_stats(&stats);
+    send_control_data(request, (const uint8_t *)&stats, sizeof(stats));
+}
+
+#if MATRIX_ANALOG
+static void vendor_get_analog_keys(SetupRequest_t *request) {
+    send_control_data(request, (const uint8_t *)analog_keys,
+                      sizeof(analog_keys));
+}
+
+static void vendor_set_actuation(SetupRequest_t *request) {
+    // Out of range values are stalled rather than truncated
+    if (request->wValue >= NUM_KEYS || request->wIndex > 0xFF ||
+        request->wIndex <= ACTUATION_HYSTERESIS) {
+        return;
+    }
+
+    clear_setup_flag();
+    analog_set_actuation(request->wValue, request->wIndex);
+    clear_status_stage(request->bmRequestType);
+}
+#endif
+
+#if PROFILE
+static void vendor_get_profile(SetupRequest_t *request) {
+    send_control_data(request, (const uint8_t *)profiles, sizeof(profiles));
+}
+
+static void vendor_reset_profile(SetupRequest_t *request) {
+    clear_setup_flag();
+    profile_reset();
+    clear_status_stage(request->bmRequestType);
+}
+#endif
+
 static void usb_device_get_status(SetupRequest_t *request) {
     clear_setup_flag();
 
@@ -306,6 +495,7 @@ static void usb_device_set_address(SetupRequest_t *request) {
     // the status stage and only then enable the address.
     UDADDR |= (1 << ADDEN);
     usb_device_state = ADDRESSED;
+    boot_times[BOOT_SET_ADDRESS] = timer_now_us();
 }
 
 static void usb_device_get_descriptor(SetupRequest_t *request) {
@@ -325,12 +515,23 @@ static void usb_device_get_descriptor(SetupRequest_t *request) {
         descriptor = (uint8_t *)&configuration_descriptor;
         descriptor_length = sizeof(configuration_descriptor);
     } else if (descriptor_type == DESCRIPTOR_CLASS_HID) {  // HID descriptor
-        descriptor = (uint8_t *)&configuration_descriptor.hid;
-        descriptor_length = sizeof(configuration_descriptor.hid);
+        // wIndex is the interface number for HID class descriptors
+        if (request->wIndex == MOUSE_INTERFACE) {
+            descriptor = (uint8_t *)&configuration_descriptor.mouse_hid;
+            descriptor_length = sizeof(configuration_descriptor.mouse_hid);
+        } else {
+            descriptor = (uint8_t *)&configuration_descriptor.hid;
+            descriptor_length = sizeof(configuration_descriptor.hid);
+        }
     } else if (descriptor_type ==
                DESCRIPTOR_CLASS_REPORT) {  // HID report descriptor
-        descriptor = (uint8_t *)hid_report_descriptor;
-        descriptor_length = 45;
+        if (request->wIndex == MOUSE_INTERFACE) {
+            descriptor = (uint8_t *)mouse_report_descriptor;
+            descriptor_length = sizeof(mouse_report_descriptor);
+        } else {
+            descriptor = (uint8_t *)hid_report_descriptor;
+            descriptor_length = sizeof(hid_report_descriptor);
+        }
     } else {
         // something else we don't know how to respond to
         return;
@@ -392,33 +593,44 @@ static void usb_device_set_configuration(SetupRequest_t *request) {
     clear_status_stage(request->bmRequestType);
 
     if (usb_device_state == ADDRESSED) {
-        bool result = configure_keyboard_endpoint();
+        bool result = configure_keyboard_endpoint() &&
+                      configure_led_endpoint() && configure_mouse_endpoint();
+#if DEBUG_CONSOLE
+        result = result && configure_console_endpoints();
+#endif
         if (result) {
             usb_device_state = CONFIGURED;
+            boot_times[BOOT_SET_CONFIGURATION] = timer_now_us();
         }
     }
-    // reset idle duration back to default
+    // reset idle duration back to default and send the first report right away
     keyboard_idle_duration = 500;
-    keyboard_idle_remaining = 0;
+    keyboard_sent_seq = report_seq - 1;
 }
 
 static void hid_get_idle(SetupRequest_t *request) {
     clear_setup_flag();
 
-    UEDATX = keyboard_idle_duration >> 2;  // The value is in increments of 4ms,
-                                           // so we need to divide by 4 first
+    UEDATX = keyboard_idle_duration >> 2;  // The value is in increments of
+                                           // 4ms, so we need to divide by 4
 
     clear_in_flag();
     clear_status_stage(request->bmRequestType);
 }
 
+static void hid_get_mouse_idle(SetupRequest_t *request) {
+    clear_setup_flag();
+    UEDATX = 0;  // Mouse reports are only sent on motion
+    clear_in_flag();
+    clear_status_stage(request->bmRequestType);
+}
+
 static void hid_set_idle(SetupRequest_t *request) {
     // The value is in increments of 4ms, so we multiply by 4 to get the
     // milliseconds
-    const uint8_t idle = (uint8_t)((request->wValue & 0xFF00) >> 6);
+    const uint16_t idle = (request->wValue & 0xFF00) >> 6;
 
     clear_setup_flag();
-
     keyboard_idle_duration = idle;
 
     clear_status_stage(request->bmRequestType);
@@ -466,16 +678,65 @@ static void hid_set_protocol(SetupRequest_t *request) {
 //     clear_status_stage(request->bmRequestType);
 // }
 
+// Sends a buffer from RAM in the data stage of a control request, split into
+// 64 byte packets
+static void send_control_data(SetupRequest_t *request, const uint8_t *data,
+                              uint16_t length) {
+    if (request->wLength < length) {
+        length = request->wLength;
+    }
+
+    clear_setup_flag();
+
+    while (length > 0) {
+        if (is_out_received()) {
+            break;
+        }  // The host aborted the data stage
+
+        if (!(is_in_ready())) {
+            continue;
+        }
+
+        uint8_t i = 0;
+        while ((length > 0) && (i < 64)) {
+            write_byte(*data++);
+            length--;
+            i++;
+        }
+
+        clear_in_flag();
+    }
+
+    clear_status_stage(request->bmRequestType);
+}
+
 static void send_report() {
-    write_byte(0);
-    write_byte(0);  // reserved
-    write_byte(KEY_A);
-    write_byte(KEY_B);
-    write_byte(KEY_C);
-    write_byte(0);
-    write_byte(0);
-    write_byte(0);
+    const uint8_t *report = (const uint8_t *)report_snapshot();
+    for (uint8_t i = 0; i < sizeof(keyboard_report_t); i++) {
+        write_byte(report[i]);
+    }
+    keyboard_sent_seq = report_seq;
 
     // clear_in_flag();
     UEINTX = 0b00111010;
-}
\ No newline at end of file
+}
+
+static void send_mouse_report() {
+    const uint8_t *report = (const uint8_t *)&mouse_report;
+    for (uint8_t i = 0; i < sizeof(mouse_report); i++) {
+        write_byte(report[i]);
+    }
+    clear_in_flag();
+}
+
+static void receive_led_report() {
+    if (!is_out_received()) {
+        return;
+    }
+
+    // A zero-length packet carries no report, just release the bank
+    if (UEBCLX > 0) {
+        leds_set(read_byte());
+    }
+    clear_out_flag();
+}
@@ -6,9 +6,22 @@ usb.h
 #include <stdbool.h>
 #include <stdint.h>
 
-extern volatile uint8_t keyboard_pressed_keys[6];
-extern volatile uint8_t keyboard_modifier;
 
+// Startup milestones, timestamped in microseconds since reset. The bus
+// milestones are overwritten on every enumeration, so after a re-enumeration
+// they describe the latest one.
+enum BOOT_MILESTONE {
+    BOOT_RESET,
+    BOOT_PLL_LOCK,
+    BOOT_BUS_RESET,
+    BOOT_SET_ADDRESS,
+    BOOT_SET_CONFIGURATION,
+    BOOT_MILESTONES,
+};
+
+extern uint32_t boot_times[BOOT_MILESTONES];
+
+void usb_enable_pll();
 void usb_init();
 int usb_send();
 int send_keypress(uint8_t, uint8_t);
@@ -36,6 +49,26 @@ int send_keypress(uint8_t, uint8_t);
 #define SET_IDLE 0x0A
 #define SET_PROTOCOL 0x0B
 
+// CDC PSTN Subclass request codes of the debug console - refer to PSTN 1.2
+// Section 6.3
+#define SET_LINE_CODING 0x20
+#define GET_LINE_CODING 0x21
+#define SET_CONTROL_LINE_STATE 0x22
+
+// Vendor specific requests used by the host tool (main.py)
+#define VENDOR_GET_KEY_STATS 0x01
+#define VENDOR_RESET_KEY_STATS 0x02
+#define VENDOR_GET_BOOT_TIMES 0x03
+#define VENDOR_GET_TASK_STATS 0x04
+#define VENDOR_RESET_TASK_STATS 0x05
+#define VENDOR_GET_SCAN_RATES 0x06  // Count, periods (u8), residency (u32)
+#define VENDOR_GET_ANALOG_KEYS 0x07
+// wValue: key, wIndex: travel (ACTUATION_HYSTERESIS + 1 - 255)
+#define VENDOR_SET_ACTUATION 0x08
+#define VENDOR_GET_PROFILE 0x09
+#define VENDOR_RESET_PROFILE 0x0A
+#define VENDOR_GET_MEMORY 0x0B
+
 // USB 2.0 Specification table 9-5
 #define DESCRIPTOR_DEVICE 1
 #define DESCRIPTOR_CONFIGURATION 2
@@ -0,0 +1,155 @@
+#ifndef BOARD_H
+#define BOARD_H
+
+// Matrix geometry of the prototype board. Columns are strobed (driven high)
+// one at a time and the rows are read back.
+#define NUM_ROWS 2
+#define NUM_COLS 4
+
+// Port B pins of the columns driven by the MCU (all but the EXPANDER_COLS)
+// and of the rows. The scan is unrolled over these at compile time, so every
+// strobe and read is a single instruction.
+#define MATRIX_COL_PINS {PORTB0, PORTB1, PORTB2, PORTB3}
+#define MATRIX_ROW_PINS {PORTB4, PORTB5}
+
+// With MATRIX_SHIFT_REGISTER the columns are driven by a chain of 74HC595
+// shift registers on the hardware SPI (SCK = PB1 -> SRCLK, MOSI = PB2 -> SER,
+// SR_LATCH_PIN -> RCLK). Column c is output c % 8 (QA-QH) of register c / 8,
+// register 0 being the one next to the MCU. The pattern of the next column is
+// shifted out while the current one settles, so this scans as fast as
+// direct GPIO columns.
+// With MATRIX_SR_ROWS the rows are read back through a chain of 74HC165 (QH
+// -> MISO = PB3, SR_LOAD_PIN -> SH/LD) in the same SPI transfer, row j is
+// input j % 8 (A-H) of register j / 8. A 16x24 matrix then takes five pins
+// (but KEY_STATS no longer fits in the RAM).
+// Otherwise the rows stay on port B (MATRIX_ROW_PINS).
+#define MATRIX_SHIFT_REGISTER 0
+#define MATRIX_SR_ROWS 0
+#define SR_LATCH_PIN PORTB0
+#define SR_LOAD_PIN PORTB6
+
+// The last EXPANDER_COLS of the NUM_COLS columns are behind an MCP23017 port
+// expander on the TWI (I2C) bus (SCL = PD0, SDA = PD1), which is read in the
+// background between scans (see expander.h). Their debounce counts sweeps of
+// the expander rather than scans. 0 means there is no expander.
+#define EXPANDER_COLS 0
+#define EXPANDER_ADDRESS 0x20
+// How often to look for an expander which is not responding (unplugged)
+#define EXPANDER_RETRY_MS 100
+#define TWI_FREQ 400000UL
+
+// Minimum time a column has to be driven high before the rows read back
+// reliably. This depends on the trace lengths and the pull-down resistors of
+// the board, so it should be measured (scope on a row pin while holding a key)
+// for each board and kept with some margin. 20us is a conservative default.
+#define MATRIX_SETTLE_US 20
+
+// When enabled, the row read of a column is processed (debounce and change
+// detection) while the next column is already settling, instead of idling
+// for the whole settle time on every column.
+#define MATRIX_PIPELINED_SCAN 1
+
+// Number of consecutive scans a column has to stay unchanged before the new
+// value is accepted.
+#define DEBOUNCE_SCANS 5
+
+// Adaptive scan rate: {idle time in ms, scan period in ms}. Once the matrix
+// has been idle for the given time, it is only scanned every period ms. The
+// first edge brings the scan back to full rate.
+#define SCAN_RATES {{1000, 1}, {10000, 4}, {60000, 16}}
+
+// All rows are on PCINT capable pins (PB0-PB7), so after SCAN_WAKEUP_IDLE_MS
+// of idle the scanning stops entirely: all columns are driven and the pin
+// change interrupt of the rows restarts the scan on the first key press.
+#define MATRIX_PCINT_WAKEUP 1
+#define SCAN_WAKEUP_IDLE_MS 5000
+
+// While waiting for the pin change the CPU clock is divided by 8 (2mhz)
+// whenever the main loop sleeps, only the interrupts run on the slow clock.
+// Everything in the main loop, including the settle delays and the WS2812
+// output, still runs at F_CPU. Control requests switch back to the full clock
+// right away.
+#define CLOCK_SCALING 0
+
+// Phase locks the scan to the USB frames: the ms tick, which starts every
+// scan at a reduced scan rate, is moved to just before the next SOF, so that
+// the scan and the report are finished right when the SOF interrupt loads the
+// report into the endpoint. The lead is the measured (average) scan and report
+// time plus SCAN_SOF_MARGIN_US, or SCAN_SOF_LEAD_US if that is not 0. Without
+// it the tick sits in the middle of the frame.
+#define SCAN_SOF_LOCK 1
+#define SCAN_SOF_MARGIN_US 50
+#define SCAN_SOF_LEAD_US 0
+
+// Analog (Hall effect) switches instead of contacts. A driven column powers
+// the sensors of its keys and the rows are sampled through the ADC, the
+// channels below are the ADC inputs of the row pins (ADC11 = PB4,
+// ADC12 = PB5). The rows cannot be used for the pin change wakeup then.
+#define MATRIX_ANALOG 0
+#define ANALOG_ROW_CHANNELS {11, 12}
+// Whether the sensor output rises (1) or falls (0) as the key goes down
+#define ANALOG_PRESS_RISES 1
+// Sensor swing (in ADC counts) assumed until a key has been bottomed out
+#define ANALOG_MIN_RANGE 200
+// Key travel runs from 0 (released) to 255 (bottomed out). A key registers
+// once it crosses its actuation point (adjustable per key over USB). With
+// rapid trigger, it is released as soon as it moves up by the given amount
+// and pressed again when it moves down by it, 0 disables rapid trigger.
+#define ANALOG_ACTUATION 128
+#define ANALOG_RAPID_TRIGGER 24
+// Replace the sensor readings with the values of analog_script.h, for
+// running the firmware in a simulator
+#define ANALOG_SCRIPT 0
+
+// Per-key press/bounce counters for tracking switch health. The counters are
+// saved to the EEPROM every KEY_STATS_SAVE_INTERVAL_MS (0 disables saving).
+#define KEY_STATS 1
+#define KEY_STATS_SAVE_INTERVAL_MS (10 * 60 * 1000UL)
+
+// How long (in ms) keys which may form a combo are held back waiting for the
+// rest of the combo
+#define COMBO_TERM_MS 50
+// Upper bound on the number of combos in the keymap
+#define MAX_COMBOS 32
+
+// Mouse keys speeds in pixels (wheel steps) per ms, 8.8 fixed point. The speed
+// ramps up from the initial to the max speed over 16 * MOUSEKEY_CURVE_STEP_MS.
+#define MOUSEKEY_INITIAL_SPEED 32         // 125 pixels/s
+#define MOUSEKEY_MAX_SPEED 512            // 2000 pixels/s
+#define MOUSEKEY_WHEEL_INITIAL_SPEED 5    // ~20 steps/s
+#define MOUSEKEY_WHEEL_MAX_SPEED 26       // ~100 steps/s
+#define MOUSEKEY_CURVE_STEP_MS 32
+
+// Debug console: an extra CDC-ACM serial interface streaming binary log
+// records (see console.h), formatted on the host with `main.py console`
+#define DEBUG_CONSOLE 0
+
+// Per-key RGB lighting, a WS2812 chain with one LED per key on RGB_PIN of
+// port D (see rgb.h). The effect is re-rendered every RGB_FRAME_MS. Refreshing
+// the chain blocks the interrupts for 30us per LED, RGB_FRAME_BUDGET_US is a
+// build time limit for that.
+#define RGB_LEDS 0
+#define RGB_PIN PORTD5
+#define RGB_FRAME_MS 20
+#define RGB_FRAME_BUDGET_US 500
+#define RGB_EFFECT RGB_EFFECT_RAINBOW
+#define RGB_HUE 160  // 0-255 around the color wheel, 160 is blue
+#define RGB_SATURATION 255
+#define RGB_BRIGHTNESS 128
+// Animations advance every 2^RGB_SPEED_SHIFT ms
+#define RGB_SPEED_SHIFT 4
+// Brightness lost per frame by a released key with RGB_EFFECT_REACTIVE
+#define RGB_FADE_STEP 8
+
+// PS/2 pointing device (TrackPoint) with its clock on INT6 (PE6) and its data
+// on PS2_DATA_PIN of port D, both lines need pull-ups (see ps2.h). The
+// movement goes out through the mouse interface, together with mouse keys.
+#define PS2_MOUSE 0
+#define PS2_DATA_PIN PORTD2
+
+// Lock indicator LEDs, all on port D and active high
+#define LED_NUM_LOCK_PIN PORTD4
+#define LED_CAPS_LOCK_PIN PORTD6
+#define LED_SCROLL_LOCK_PIN PORTD7
+
+#endif
@@ -0,0 +1,154 @@
+#include "combo.h"
+
+#include "keymap.h"
+#include "report.h"
+#include "timer.h"
+
+// Union of the keys of all combos, only these keys are ever held back
+static matrix_rows_t combo_keys[NUM_COLS];
+// Keys held back until we know whether they form a combo
+static matrix_rows_t pending[NUM_COLS];
+// Keys which triggered a combo, hidden from the report until released
+static matrix_rows_t consumed[NUM_COLS];
+// Keys which were released while still pending, they are reported for one
+// update so that a quick tap is not lost
+static matrix_rows_t tapped[NUM_COLS];
+static matrix_rows_t previous[NUM_COLS];
+
+static uint8_t active[(MAX_COMBOS + 7) / 8];
+static uint16_t pending_since = 0;
+static bool has_pending = false;
+
+__attribute__((always_inline)) static inline matrix_rows_t combo_mask(
+    uint8_t combo, uint8_t col) {
+#if NUM_ROWS > 8
+    return pgm_read_word(&combos[combo].keys[col]);
+#else
+    return pgm_read_byte(&combos[combo].keys[col]);
+#endif
+}
+
+__attribute__((always_inline)) static inline bool is_active(uint8_t combo) {
+    return active[combo >> 3] & (1 << (combo & 7));
+}
+
+void combo_init() {
+    for (uint8_t i = 0; i < NUM_COLS; i++) {
+        combo_keys[i] = 0;
+        for (uint8_t c = 0; c < num_combos; c++) {
+            combo_keys[i] |= combo_mask(c, i);
+        }
+    }
+}
+
+static void flush_pending() {
+    for (uint8_t i = 0; i < NUM_COLS; i++) {
+        pending[i] = 0;
+    }
+    has_pending = false;
+}
+
+// Returns the index of the combo whose keys are exactly the pending keys,
+// num_combos if the pending keys can still grow into a combo and -1 if no
+// combo can match anymore.
+static int8_t match_pending() {
+    bool possible = false;
+    for (uint8_t c = 0; c < num_combos; c++) {
+        bool exact = true;
+        bool subset = true;
+        for (uint8_t i = 0; i < NUM_COLS; i++) {
+            const matrix_rows_t mask = combo_mask(c, i);
+            if (pending[i] & ~mask) {
+                subset = false;
+                break;
+            }
+            if (pending[i] != mask) {
+                exact = false;
+            }
+        }
+        if (subset && exact) {
+            return c;
+        }
+        possible |= subset;
+    }
+    return possible ? num_combos : -1;
+}
+
+void combo_process(const matrix_rows_t *pressed, matrix_rows_t *visible) {
+    bool pending_changed = false;
+    bool released = false;
+    bool flush = false;
+
+    for (uint8_t i = 0; i < NUM_COLS; i++) {
+        const matrix_rows_t down = pressed[i] & ~previous[i];
+        const matrix_rows_t up = previous[i] & ~pressed[i];
+        previous[i] = pressed[i];
+
+        consumed[i] &= pressed[i];
+        if (up) {
+            released = true;
+        }
+
+        if (up & pending[i]) {
+            tapped[i] |= up & pending[i];
+            flush = true;
+        }
+
+        if (down & ~combo_keys[i]) {
+            // A key which is not part of any combo interrupts the combo
+            flush = true;
+        } else if (down) {
+            pending[i] |= down;
+            pending_changed = true;
+        }
+    }
+
+    // A combo stays active until any of its keys is released
+    for (uint8_t c = 0; released && c < num_combos; c++) {
+        if (!is_active(c)) {
+            continue;
+        }
+        for (uint8_t i = 0; i < NUM_COLS; i++) {
+            if (combo_mask(c, i) & ~pressed[i]) {
+                active[c >> 3] &= ~(1 << (c & 7));
+                report_remove_keycode(pgm_read_byte(&combos[c].keycode));
+                break;
+            }
+        }
+    }
+
+    if (pending_changed && !has_pending) {
+        has_pending = true;
+        pending_since = timer_millis();
+    }
+
+    if (flush) {
+        flush_pending();
+    } else if (has_pending) {
+        // Matching only runs when the pending keys change, otherwise we only
+        // check the timeout, so the cost per scan does not depend on the
+        // number of combos
+        if (pending_changed) {
+            const int8_t combo = match_pending();
+            if (combo < 0) {
+                flush_pending();
+            } else if (combo < num_combos) {
+                active[combo >> 3] |= (1 << (combo & 7));
+                report_add_keycode(pgm_read_byte(&combos[combo].keycode));
+                for (uint8_t i = 0; i < NUM_COLS; i++) {
+                    consumed[i] |= pending[i];
+                }
+                flush_pending();
+            }
+        }
+        if (has_pending &&
+            (uint16_t)(timer_millis() - pending_since) >= COMBO_TERM_MS) {
+            flush_pending();
+        }
+    }
+
+    for (uint8_t i = 0; i < NUM_COLS; i++) {
+        visible[i] = ((pressed[i] & ~pending[i]) | tapped[i]) & ~consumed[i];
+        tapped[i] = 0;
+    }
+}
@@ -0,0 +1,24 @@
+#ifndef COMBO_H
+#define COMBO_H
+#include <avr/pgmspace.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "matrix.h"
+
+// A combo sends `keycode` when all keys in `keys` are pressed together.
+// `keys` uses the same layout as the matrix state, i.e. one bitmask of rows
+// per column.
+typedef struct {
+    matrix_rows_t keys[NUM_COLS];
+    uint8_t keycode;
+} combo_t;
+
+void combo_init();
+// Filters the debounced matrix state: keys which may still become part of a
+// combo are held back and keys consumed by an active combo are hidden. The
+// keycodes of combos are added to (and removed from) the report directly.
+// `pressed` and `visible` are NUM_COLS long.
+void combo_process(const matrix_rows_t *pressed, matrix_rows_t *visible);
+
+#endif
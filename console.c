@@ -0,0 +1,111 @@
+#include "console.h"
+
+#include "timer.h"
+
+#if DEBUG_CONSOLE
+
+// Must be a power of two
+#define CONSOLE_RECORDS 32
+
+static console_record_t records[CONSOLE_RECORDS];
+static volatile uint8_t head = 0;  // Written by console_log()
+static volatile uint8_t tail = 0;  // Written by console_flush()
+static uint16_t dropped = 0;
+
+static volatile bool console_open = false;
+// Only stored, there is no actual serial line behind the console. 115200 8N1.
+static uint8_t line_coding[7] = {0x00, 0xC2, 0x01, 0x00, 0, 0, 8};
+
+static void put(uint8_t index, uint8_t event, uint8_t arg, uint16_t value,
+                uint32_t time) {
+    console_record_t *record = &records[index & (CONSOLE_RECORDS - 1)];
+    record->event = event;
+    record->arg = arg;
+    record->value = value;
+    record->time = time;
+}
+
+void console_log(uint8_t event, uint8_t arg, uint16_t value) {
+    if (!console_open) {
+        return;
+    }
+
+    uint8_t index = head;
+    const uint8_t free = CONSOLE_RECORDS - (uint8_t)(index - tail);
+    if (free < (dropped > 0 ? 2 : 1)) {
+        if (dropped < UINT16_MAX) {
+            dropped++;
+        }
+        return;
+    }
+
+    const uint32_t time = timer_millis();
+    if (dropped > 0) {
+        put(index++, CONSOLE_DROPPED, 0, dropped, time);
+        dropped = 0;
+    }
+    put(index, event, arg, value, time);
+    // The records have to be complete before the interrupt can see them
+    __asm__ __volatile__("" ::: "memory");
+    head = index + 1;
+}
+
+void console_flush() {
+    select_console_out_endpoint();
+    if (is_out_received()) {
+        clear_out_flag();  // Whatever is typed into the terminal is ignored
+    }
+
+    select_console_in_endpoint();
+    if (!console_open || !endpoint_is_read_write_allowed()) {
+        return;
+    }
+
+    uint8_t index = tail;
+    uint8_t count = 0;
+    while (index != head && count < 64 / sizeof(console_record_t)) {
+        const uint8_t *record =
+            (const uint8_t *)&records[index & (CONSOLE_RECORDS - 1)];
+        for (uint8_t i = 0; i < sizeof(console_record_t); i++) {
+            write_byte(record[i]);
+        }
+        index++;
+        count++;
+    }
+    if (count > 0) {
+        tail = index;
+        clear_in_flag();
+    }
+}
+
+void console_get_line_coding(SetupRequest_t *request) {
+    clear_setup_flag();
+    for (uint8_t i = 0; i < sizeof(line_coding) && i < request->wLength; i++) {
+        write_byte(line_coding[i]);
+    }
+    clear_in_flag();
+    clear_status_stage(request->bmRequestType);
+}
+
+void console_set_line_coding(SetupRequest_t *request) {
+    clear_setup_flag();
+    while (!(is_out_received()))
+        ;
+    for (uint8_t i = 0; i < sizeof(line_coding) && i < request->wLength; i++) {
+        line_coding[i] = read_byte();
+    }
+    clear_out_flag();
+    clear_status_stage(request->bmRequestType);
+}
+
+void console_set_control_line_state(SetupRequest_t *request) {
+    clear_setup_flag();
+    // A terminal raises DTR while it is open
+    console_open = request->wValue & 0x01;
+    if (!console_open) {
+        tail = head;  // Nobody is listening anymore
+    }
+    clear_status_stage(request->bmRequestType);
+}
+
+#endif
@@ -0,0 +1,46 @@
+#ifndef CONSOLE_H
+#define CONSOLE_H
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "board.h"
+#include "endpoints.h"
+
+// Debug console over a CDC-ACM serial interface (DEBUG_CONSOLE). Log records
+// are 8 byte binary structs, formatted by the host (main.py console), passed
+// to the bulk IN endpoint through a ring buffer. The main loop is the only
+// writer and the SOF interrupt the only reader, so the ring needs no locking.
+// Nothing is logged while no terminal is open (DTR is not set), and records
+// which do not fit are dropped and counted, logging never waits.
+
+enum CONSOLE_EVENT {
+    CONSOLE_DROPPED,    // value: number of records dropped before this one
+    CONSOLE_KEY_DOWN,   // value: key index
+    CONSOLE_KEY_UP,     // value: key index
+    CONSOLE_SCAN_RATE,  // arg: scan rate index, see scan_rate.h
+};
+
+typedef struct {
+    uint8_t event;
+    uint8_t arg;
+    uint16_t value;
+    uint32_t time;  // timer_millis()
+} console_record_t;
+
+#if DEBUG_CONSOLE
+// Must only be called from the main loop
+void console_log(uint8_t event, uint8_t arg, uint16_t value);
+// Sends the pending records, called on every SOF once configured
+void console_flush();
+
+// CDC class requests of the console interface
+void console_get_line_coding(SetupRequest_t *request);
+void console_set_line_coding(SetupRequest_t *request);
+void console_set_control_line_state(SetupRequest_t *request);
+#else
+__attribute__((always_inline)) static inline void console_log(uint8_t event,
+                                                             uint8_t arg,
+                                                             uint16_t value) {}
+#endif
+
+#endif
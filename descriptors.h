@@ -2,6 +2,8 @@
 #include <avr/pgmspace.h>
 #include <stdint.h>
 
+#include "board.h"
+
 // http://www.linux-usb.org/usb.ids
 #define IDVENDOR 0x03eb   // Atmel Corp.
 #define IDPRODUCT 0x2ff4  // ATMega32u4 DFU Bootloader
@@ -65,22 +67,187 @@ typedef struct {
     uint8_t bInterval;
 } __attribute__((packed)) USB_EndpointDescriptor_t;
 
+// USB ECN Interface Association Descriptors, groups the two interfaces of
+// the console into a single function
+typedef struct {
+    uint8_t bLength;
+    uint8_t bDescriptorType;
+    uint8_t bFirstInterface;
+    uint8_t bInterfaceCount;
+    uint8_t bFunctionClass;
+    uint8_t bFunctionSubClass;
+    uint8_t bFunctionProtocol;
+    uint8_t iFunction;
+} __attribute__((packed)) USB_InterfaceAssociationDescriptor_t;
+
+// CDC 1.2 Section 5.2.3 functional descriptors
+typedef struct {
+    uint8_t bFunctionLength;
+    uint8_t bDescriptorType;
+    uint8_t bDescriptorSubtype;
+    uint16_t bcdCDC;
+} __attribute__((packed)) CDC_HeaderDescriptor_t;
+
+typedef struct {
+    uint8_t bFunctionLength;
+    uint8_t bDescriptorType;
+    uint8_t bDescriptorSubtype;
+    uint8_t bmCapabilities;
+    uint8_t bDataInterface;
+} __attribute__((packed)) CDC_CallManagementDescriptor_t;
+
+typedef struct {
+    uint8_t bFunctionLength;
+    uint8_t bDescriptorType;
+    uint8_t bDescriptorSubtype;
+    uint8_t bmCapabilities;
+} __attribute__((packed)) CDC_ACMDescriptor_t;
+
+typedef struct {
+    uint8_t bFunctionLength;
+    uint8_t bDescriptorType;
+    uint8_t bDescriptorSubtype;
+    uint8_t bMasterInterface;
+    uint8_t bSlaveInterface0;
+} __attribute__((packed)) CDC_UnionDescriptor_t;
+
 typedef struct {
     USB_ConfigurationDescriptor_t configration;
     USB_InterfaceDescriptor_t interface;
     USB_HIDDescriptor_t hid;
     USB_EndpointDescriptor_t endpoint;
+    USB_EndpointDescriptor_t led_endpoint;
+    USB_InterfaceDescriptor_t mouse_interface;
+    USB_HIDDescriptor_t mouse_hid;
+    USB_EndpointDescriptor_t mouse_endpoint;
+#if DEBUG_CONSOLE
+    USB_InterfaceAssociationDescriptor_t console_association;
+    USB_InterfaceDescriptor_t console_interface;
+    CDC_HeaderDescriptor_t console_header;
+    CDC_CallManagementDescriptor_t console_call_management;
+    CDC_ACMDescriptor_t console_acm;
+    CDC_UnionDescriptor_t console_union;
+    USB_EndpointDescriptor_t console_notification_endpoint;
+    USB_InterfaceDescriptor_t console_data_interface;
+    USB_EndpointDescriptor_t console_in_endpoint;
+    USB_EndpointDescriptor_t console_out_endpoint;
+#endif
 } USB_Configuration_t;
 
+#define KEYBOARD_INTERFACE 0
+#define MOUSE_INTERFACE 1
+#define CONSOLE_INTERFACE 2
+#define CONSOLE_DATA_INTERFACE 3
+
+#if DEBUG_CONSOLE
+#define NUM_INTERFACES 4
+#else
+#define NUM_INTERFACES 2
+#endif
+
 typedef uint8_t USB_HIDReportDescriptor_t;
 
+#define REPORT_SIZE 6
+
+// Boot protocol compatible report descriptor
+// See https://www.devever.net/~hl/usbnkro
+static const USB_HIDReportDescriptor_t hid_report_descriptor[] PROGMEM = {
+    0x05, 0x01,  // Usage Page - Generic Desktop - HID Spec Appendix E E.6 - The
+                 // values for the HID tags are not clearly listed anywhere
+                 // really, so this table is very useful
+    0x09, 0x06,  // Usage - Keyboard
+    0xA1, 0x01,  // Collection - Application
+
+    // <--------------------------------------------->
+
+    0x05, 0x07,  // Usage Page - Key Codes
+    0x19, 0xE0,  // Usage Minimum - The bit that controls the 8 modifier
+                 // characters (ctrl, command, etc)
+    0x29, 0xE7,  // Usage Maximum - The end of the modifier bit (0xE7 - 0xE0 = 1 byte)
+    0x15, 0x00,  // Logical Minimum - These keys are either not pressed or
+                 // pressed, 0 or 1
+    0x25, 0x01,  // Logical Maximum - Pressed state == 1
+    0x75, 0x01,  // Report Size - The size of the IN report to the host
+    0x95, 0x08,  // Report Count - The number of keys in the report
+    0x81, 0x02,  // Input (Data, Variable, Absolute) ;Modifier byte
+
+    0x95, 0x01,  // Report Count - 1
+    0x75, 0x08,  // Report Size - 8
+    0x81, 0x01,  // This byte is reserved according to the spec
+
+    0x95, REPORT_SIZE,  // Report Count - For the keys
+    0x75, 0x08,  // Report Size - For the keys
+    0x15, 0x00,  // Logical Minimum
+    0x25, 0x65,  // Logical Maximum
+    0x05, 0x07,  // Usage Page - Key Codes
+    0x19, 0x00,  // Usage Minimum - 0
+    0x29, 0x65,  // Usage Maximum - 101
+    0x81, 0x00,  // Input - Data, Array ;Key array (6 bytes)
+
+    // <--------------------------------------------->
+
+    0x95, 0x05,  // Report Count - 5 lock indicator LEDs
+    0x75, 0x01,  // Report Size - 1 bit each
+    0x25, 0x01,  // Logical Maximum - LED is either off or on
+    0x05, 0x08,  // Usage Page - LEDs
+    0x19, 0x01,  // Usage Minimum - Num Lock
+    0x29, 0x05,  // Usage Maximum - Kana
+    0x91, 0x02,  // Output (Data, Variable, Absolute) ;LED report
+    0x95, 0x01,  // Report Count - 1
+    0x75, 0x03,  // Report Size - 3
+    0x91, 0x01,  // Output (Constant) ;LED report padding to a full byte
+    0xC0         // End collection
+};
+
+// Report descriptor of the mouse interface, driven by mouse keys
+static const USB_HIDReportDescriptor_t mouse_report_descriptor[] PROGMEM = {
+    0x05, 0x01,  // Usage Page - Generic Desktop
+    0x09, 0x02,  // Usage - Mouse
+    0xA1, 0x01,  // Collection - Application
+    0x09, 0x01,  // Usage - Pointer
+    0xA1, 0x00,  // Collection - Physical
+
+    0x05, 0x09,  // Usage Page - Buttons
+    0x19, 0x01,  // Usage Minimum - Button 1
+    0x29, 0x03,  // Usage Maximum - Button 3
+    0x15, 0x00,  // Logical Minimum - 0
+    0x25, 0x01,  // Logical Maximum - 1
+    0x95, 0x03,  // Report Count - 3
+    0x75, 0x01,  // Report Size - 1
+    0x81, 0x02,  // Input (Data, Variable, Absolute) ;Buttons
+    0x95, 0x01,  // Report Count - 1
+    0x75, 0x05,  // Report Size - 5
+    0x81, 0x01,  // Input (Constant) ;Button padding
+
+    0x05, 0x01,  // Usage Page - Generic Desktop
+    0x09, 0x30,  // Usage - X
+    0x09, 0x31,  // Usage - Y
+    0x09, 0x38,  // Usage - Wheel
+    0x15, 0x81,  // Logical Minimum - -127
+    0x25, 0x7F,  // Logical Maximum - 127
+    0x75, 0x08,  // Report Size - 8
+    0x95, 0x03,  // Report Count - 3
+    0x81, 0x06,  // Input (Data, Variable, Relative) ;X, Y, Wheel
+
+    0xC0,        // End collection
+    0xC0         // End collection
+};
+
 const USB_DeviceDescriptor_t device_descriptor PROGMEM = {
     .bLength = 0x12,
     .bDescriptorType = 0x01,
     .bcdUSB = 0x200,
+#if DEBUG_CONSOLE
+    // Miscellaneous device using interface association descriptors, the
+    // console is a function of its own next to the HID interfaces
+    .bDeviceClass = 0xEF,
+    .bDeviceSubClass = 0x02,
+    .bDeviceProtocol = 0x01,
+#else
     .bDeviceClass = 0x00,
     .bDeviceSubClass = 0x00,
     .bDeviceProtocol = 0x00,
+#endif
     .bMaxPacketSize0 = 0x40,  // 64
     .idVendor = IDVENDOR,
     .idProduct = IDPRODUCT,
@@ -93,17 +260,17 @@ const USB_DeviceDescriptor_t device_descriptor PROGMEM = {
 const USB_Configuration_t configuration_descriptor PROGMEM = {
     .configration = {.bLength = 0x09,
                      .bDescriptorType = 0x02,
-                     .wTotalLength = 0x22,
-                     .bNumInterfaces = 0x01,
+                     .wTotalLength = sizeof(USB_Configuration_t),
+                     .bNumInterfaces = NUM_INTERFACES,
                      .bConfigurationValue = 0x01,
                      .iConfiguration = 0x00,
                      .bmAttributes = 0b10100000,
                      .bMaxPower = 0x20},
     .interface = {.bLength = 0x09,
                   .bDescriptorType = 0x04,
-                  .bInterfaceNumber = 0x00,
+                  .bInterfaceNumber = KEYBOARD_INTERFACE,
                   .bAlternateSetting = 0x00,
-                  .bNumEndpoints = 0x01,
+                  .bNumEndpoints = 0x02,
                   .bInterfaceClass = 0x03,
                   .bInterfaceSubClass = 0x01,
                   .bInterfaceProtocol = 0x01,
@@ -116,54 +283,117 @@ const USB_Configuration_t configuration_descriptor PROGMEM = {
             .bCountryCode = 0x00,
             .bNumDescriptors = 0x01,
             .bReportDescriptorType = 0x22,
-            .wDescriptorLength = 45  // size of the HID report descriptor
+            .wDescriptorLength = sizeof(hid_report_descriptor)
         },
     .endpoint = {.bLength = 0x07,
                  .bDescriptorType = 0x05,
                  .bEndpointAddress = 0b10000001,
                  .bmAttributes = 0b00000011,
                  .wMaxPacketSize = 0x40,  // 64
-                 .bInterval = 0x0A}};
-
-
-#define REPORT_SIZE 6
-
-// Boot protocol compatible report descriptor
-// See https://www.devever.net/~hl/usbnkro
-static const USB_HIDReportDescriptor_t hid_report_descriptor[] PROGMEM = {
-    0x05, 0x01,  // Usage Page - Generic Desktop - HID Spec Appendix E E.6 - The
-                 // values for the HID tags are not clearly listed anywhere
-                 // really, so this table is very useful
-    0x09, 0x06,  // Usage - Keyboard
-    0xA1, 0x01,  // Collection - Application
-
-    // <--------------------------------------------->
+                 .bInterval = 0x0A},
+    // Interrupt OUT endpoint for the LED output report, so that lock LED
+    // updates don't have to go through the control endpoint
+    .led_endpoint = {.bLength = 0x07,
+                     .bDescriptorType = 0x05,
+                     .bEndpointAddress = 0b00000010,
+                     .bmAttributes = 0b00000011,
+                     .wMaxPacketSize = 0x08,
+                     .bInterval = 0x0A},
+    // Mouse keys get their own interface so that mouse reports never delay
+    // keyboard reports. Not a boot device, so no subclass/protocol.
+    .mouse_interface = {.bLength = 0x09,
+                        .bDescriptorType = 0x04,
+                        .bInterfaceNumber = MOUSE_INTERFACE,
+                        .bAlternateSetting = 0x00,
+                        .bNumEndpoints = 0x01,
+                        .bInterfaceClass = 0x03,
+                        .bInterfaceSubClass = 0x00,
+                        .bInterfaceProtocol = 0x00,
+                        .iInterface = 0x00},
+    .mouse_hid = {.bLength = 0x09,
+                  .bDescriptorType = 0x21,
+                  .bcdHID = 0x101,
+                  .bCountryCode = 0x00,
+                  .bNumDescriptors = 0x01,
+                  .bReportDescriptorType = 0x22,
+                  .wDescriptorLength = sizeof(mouse_report_descriptor)},
+    // Polled every frame so that the cursor moves smoothly
+    .mouse_endpoint = {.bLength = 0x07,
+                       .bDescriptorType = 0x05,
+                       .bEndpointAddress = 0b10000011,
+                       .bmAttributes = 0b00000011,
+                       .wMaxPacketSize = 0x08,
+                       .bInterval = 0x01},
+#if DEBUG_CONSOLE
+    .console_association = {.bLength = 0x08,
+                            .bDescriptorType = 0x0B,
+                            .bFirstInterface = CONSOLE_INTERFACE,
+                            .bInterfaceCount = 0x02,
+                            .bFunctionClass = 0x02,
+                            .bFunctionSubClass = 0x02,
+                            .bFunctionProtocol = 0x00,
+                            .iFunction = 0x00},
+    // Communications class, abstract control model
+    .console_interface = {.bLength = 0x09,
+                          .bDescriptorType = 0x04,
+                          .bInterfaceNumber = CONSOLE_INTERFACE,
+                          .bAlternateSetting = 0x00,
+                          .bNumEndpoints = 0x01,
+                          .bInterfaceClass = 0x02,
+                          .bInterfaceSubClass = 0x02,
+                          .bInterfaceProtocol = 0x00,
+                          .iInterface = 0x00},
+    .console_header = {.bFunctionLength = 0x05,
+                       .bDescriptorType = 0x24,
+                       .bDescriptorSubtype = 0x00,
+                       .bcdCDC = 0x0110},
+    .console_call_management = {.bFunctionLength = 0x05,
+                                .bDescriptorType = 0x24,
+                                .bDescriptorSubtype = 0x01,
+                                .bmCapabilities = 0x00,
+                                .bDataInterface = CONSOLE_DATA_INTERFACE},
+    // Supports SET/GET_LINE_CODING and SET_CONTROL_LINE_STATE
+    .console_acm = {.bFunctionLength = 0x04,
+                    .bDescriptorType = 0x24,
+                    .bDescriptorSubtype = 0x02,
+                    .bmCapabilities = 0x02},
+    .console_union = {.bFunctionLength = 0x05,
+                      .bDescriptorType = 0x24,
+                      .bDescriptorSubtype = 0x06,
+                      .bMasterInterface = CONSOLE_INTERFACE,
+                      .bSlaveInterface0 = CONSOLE_DATA_INTERFACE},
+    // Required by the class, no notification is ever sent on it
+    .console_notification_endpoint = {.bLength = 0x07,
+                                      .bDescriptorType = 0x05,
+                                      .bEndpointAddress = 0b10000100,
+                                      .bmAttributes = 0b00000011,
+                                      .wMaxPacketSize = 0x08,
+                                      .bInterval = 0xFF},
+    .console_data_interface = {.bLength = 0x09,
+                               .bDescriptorType = 0x04,
+                               .bInterfaceNumber = CONSOLE_DATA_INTERFACE,
+                               .bAlternateSetting = 0x00,
+                               .bNumEndpoints = 0x02,
+                               .bInterfaceClass = 0x0A,
+                               .bInterfaceSubClass = 0x00,
+                               .bInterfaceProtocol = 0x00,
+                               .iInterface = 0x00},
+    .console_in_endpoint = {.bLength = 0x07,
+                            .bDescriptorType = 0x05,
+                            .bEndpointAddress = 0b10000101,
+                            .bmAttributes = 0b00000010,
+                            .wMaxPacketSize = 0x40,  // 64
+                            .bInterval = 0x00},
+    .console_out_endpoint = {.bLength = 0x07,
+                             .bDescriptorType = 0x05,
+                             .bEndpointAddress = 0b00000110,
+                             .bmAttributes = 0b00000010,
+                             .wMaxPacketSize = 0x40,  // 64
+                             .bInterval = 0x00},
+#endif
+};
 
-    0x05, 0x07,  // Usage Page - Key Codes
-    0x19, 0xE0,  // Usage Minimum - The bit that controls the 8 modifier
-                 // characters (ctrl, command, etc)
-    0x29, 0xE7,  // Usage Maximum - The end of the modifier bit (0xE7 - 0xE0 = 1 byte)
-    0x15, 0x00,  // Logical Minimum - These keys are either not pressed or
-                 // pressed, 0 or 1
-    0x25, 0x01,  // Logical Maximum - Pressed state == 1
-    0x75, 0x01,  // Report Size - The size of the IN report to the host
-    0x95, 0x08,  // Report Count - The number of keys in the report
-    0x81, 0x02,  // Input (Data, Variable, Absolute) ;Modifier byte
 
-    0x95, 0x01,  // Report Count - 1
-    0x75, 0x08,  // Report Size - 8
-    0x81, 0x01,  // This byte is reserved according to the spec
-
-    0x95, REPORT_SIZE,  // Report Count - For the keys
-    0x75, 0x08,  // Report Size - For the keys
-    0x15, 0x00,  // Logical Minimum
-    0x25, 0x65,  // Logical Maximum
-    0x05, 0x07,  // Usage Page - Key Codes
-    0x19, 0x00,  // Usage Minimum - 0
-    0x29, 0x65,  // Usage Maximum - 101
-    0x81, 0x00,  // Input - Data, Array ;Key array (6 bytes)
-    0xC0         // End collection
-};
 
 
 // static const USB_HIDReportDescriptor_t hid_report_descriptor[] PROGMEM = {
@@ -15,6 +15,22 @@ void select_keyboard_endpoint() {
     UENUM = 1;
 }
 
+void select_led_endpoint() {
+    UENUM = 2;
+}
+
+void select_mouse_endpoint() {
+    UENUM = 3;
+}
+
+void select_console_in_endpoint() {
+    UENUM = 5;
+}
+
+void select_console_out_endpoint() {
+    UENUM = 6;
+}
+
 bool configure_control_endpoint() {
     UENUM = 0;             // Select Endpoint 0, the default control endpoint
     UECONX = (1 << EPEN);  // Enable the Endpoint
@@ -53,3 +69,80 @@ bool configure_keyboard_endpoint() {
 
     return true;
 }
+
+bool configure_led_endpoint() {
+    UENUM = 2;             // Select Endpoint 2
+    UECONX = (1 << EPEN);  // Enable the Endpoint
+    UECFG0X = (1 << EPTYPE1) | (1 << EPTYPE0);  // Interrupt OUT endpoint
+    UECFG1X |= (1 << ALLOC);  // 8 byte endpoint, single-bank, allocate the
+                              // memory
+
+    if (!(UESTA0X &
+          (1 << CFGOK))) {  // Check if endpoint configuration was successful
+        return false;
+    }
+
+    UERST |= (1 << EPRST2);  // Reset Endpoint (potentially unnecessary?)
+    UERST &= ~(1 << EPRST2);
+
+    UEIENX = (1 << RXOUTE);  // Enable the Received OUT Data Interrupt
+    return true;
+}
+
+bool configure_mouse_endpoint() {
+    UENUM = 3;             // Select Endpoint 3
+    UECONX = (1 << EPEN);  // Enable the Endpoint
+    UECFG0X =
+        (1 << EPTYPE1) | (1 << EPTYPE0) | (1 << EPDIR);  // Interrupt IN endpoint
+    UECFG1X |= (1 << ALLOC);  // 8 byte endpoint, single-bank, allocate the
+                              // memory
+
+    if (!(UESTA0X &
+          (1 << CFGOK))) {  // Check if endpoint configuration was successful
+        return false;
+    }
+
+    UERST |= (1 << EPRST3);  // Reset Endpoint (potentially unnecessary?)
+    UERST &= ~(1 << EPRST3);
+
+    return true;
+}
+
+// Endpoints 4-6 of the debug console (DEBUG_CONSOLE), the notification
+// endpoint is only allocated because the CDC class requires it
+bool configure_console_endpoints() {
+    UENUM = 4;             // Select Endpoint 4
+    UECONX = (1 << EPEN);  // Enable the Endpoint
+    // Interrupt IN endpoint
+    UECFG0X = (1 << EPTYPE1) | (1 << EPTYPE0) | (1 << EPDIR);
+    UECFG1X |= (1 << ALLOC);  // 8 byte endpoint, single-bank, allocate the
+                              // memory
+    if (!(UESTA0X & (1 << CFGOK))) {
+        return false;
+    }
+
+    UENUM = 5;                                // Select Endpoint 5
+    UECONX = (1 << EPEN);                     // Enable the Endpoint
+    UECFG0X = (1 << EPTYPE1) | (1 << EPDIR);  // Bulk IN endpoint
+    UECFG1X |= (1 << EPSIZE1) | (1 << EPSIZE0) |
+               (1 << ALLOC);  // 64 byte endpoint, single-bank, allocate the
+                              // memory
+    if (!(UESTA0X & (1 << CFGOK))) {
+        return false;
+    }
+
+    UENUM = 6;                 // Select Endpoint 6
+    UECONX = (1 << EPEN);      // Enable the Endpoint
+    UECFG0X = (1 << EPTYPE1);  // Bulk OUT endpoint
+    UECFG1X |= (1 << EPSIZE1) | (1 << EPSIZE0) |
+               (1 << ALLOC);  // 64 byte endpoint, single-bank, allocate the
+                              // memory
+    if (!(UESTA0X & (1 << CFGOK))) {
+        return false;
+    }
+
+    UERST |= (1 << EPRST4) | (1 << EPRST5) | (1 << EPRST6);
+    UERST &= ~((1 << EPRST4) | (1 << EPRST5) | (1 << EPRST6));
+
+    return true;
+}
@@ -88,7 +88,14 @@ endpoint_is_read_write_allowed() {
 void read_setup_request(SetupRequest_t *request);
 void select_control_endpoint();
 void select_keyboard_endpoint();
+void select_led_endpoint();
+void select_mouse_endpoint();
+void select_console_in_endpoint();
+void select_console_out_endpoint();
 bool configure_control_endpoint();
 bool configure_keyboard_endpoint();
+bool configure_led_endpoint();
+bool configure_mouse_endpoint();
+bool configure_console_endpoints();
 
 #endif
\ No newline at end of file
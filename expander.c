@@ -0,0 +1,146 @@
+#include "expander.h"
+
+#include <util/atomic.h>
+
+#include "timer.h"
+#include "twi.h"
+
+#if EXPANDER_COLS
+
+#if NUM_ROWS > 8
+#error "The expander only has 8 row inputs"
+#endif
+#if EXPANDER_COLS > 8
+#error "The expander only has 8 column outputs"
+#endif
+
+// MCP23017 registers with IOCON.BANK = 0 (the power on default)
+#define MCP23017_IODIRA 0x00
+#define MCP23017_GPPUB 0x0D
+#define MCP23017_GPIOB 0x13
+
+static const uint8_t configure_command[] = {MCP23017_GPPUB, 0xFF};
+static uint8_t select_command[] = {MCP23017_IODIRA, 0xFF};
+static const uint8_t read_command[] = {MCP23017_GPIOB};
+static uint8_t rows_read;
+
+static void configured(twi_transaction_t *transaction, bool ok);
+static void selected(twi_transaction_t *transaction, bool ok);
+static void rows_received(twi_transaction_t *transaction, bool ok);
+
+static twi_transaction_t configure_transaction = {
+    .address = EXPANDER_ADDRESS,
+    .write_length = sizeof(configure_command),
+    .write = configure_command,
+    .done = configured,
+};
+static twi_transaction_t select_transaction = {
+    .address = EXPANDER_ADDRESS,
+    .write_length = sizeof(select_command),
+    .write = select_command,
+    .done = selected,
+};
+static twi_transaction_t read_transaction = {
+    .address = EXPANDER_ADDRESS,
+    .write_length = sizeof(read_command),
+    .read_length = 1,
+    .write = read_command,
+    .read = &rows_read,
+    .done = rows_received,
+};
+
+static volatile matrix_rows_t expander_rows[EXPANDER_COLS];
+static volatile uint8_t fresh = 0;
+static volatile bool sweeping = false;
+static volatile bool online = false;
+static uint8_t col;
+static uint32_t last_attempt = 0;
+
+void expander_init() {
+    twi_init();
+}
+
+static void select_column() {
+    select_command[1] = ~(1 << col);  // Only the selected column is an output
+    twi_queue(&select_transaction);
+}
+
+// The expander did not respond, release all its keys until it is back
+static void go_offline() {
+    for (uint8_t c = 0; c < EXPANDER_COLS; c++) {
+        expander_rows[c] = 0;
+    }
+    fresh = (1 << EXPANDER_COLS) - 1;
+    online = false;
+    sweeping = false;
+}
+
+static void configured(twi_transaction_t *transaction, bool ok) {
+    if (!ok) {
+        go_offline();
+        return;
+    }
+    online = true;
+    select_column();
+}
+
+static void selected(twi_transaction_t *transaction, bool ok) {
+    if (!ok) {
+        go_offline();
+        return;
+    }
+    twi_queue(&read_transaction);
+}
+
+static void rows_received(twi_transaction_t *transaction, bool ok) {
+    if (!ok) {
+        go_offline();
+        return;
+    }
+    // Pressed keys pull their row low
+    expander_rows[col] = (uint8_t)~rows_read & ((1 << NUM_ROWS) - 1);
+    fresh |= (1 << col);
+
+    if (++col < EXPANDER_COLS) {
+        select_column();
+    } else {
+        sweeping = false;
+    }
+}
+
+void expander_start_sweep() {
+    if (sweeping) {
+        return;
+    }
+    if (!online) {
+        // Do not keep the bus busy with a missing (unplugged) expander
+        const uint32_t now = timer_millis();
+        if (now - last_attempt < EXPANDER_RETRY_MS) {
+            return;
+        }
+        last_attempt = now;
+    }
+
+    sweeping = true;
+    col = 0;
+    // The pull-ups are lost if the expander was power cycled
+    if (online) {
+        select_column();
+    } else {
+        twi_queue(&configure_transaction);
+    }
+}
+
+uint8_t expander_take_fresh(matrix_rows_t *rows) {
+    uint8_t columns;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        columns = fresh;
+        fresh = 0;
+        for (uint8_t c = 0; c < EXPANDER_COLS; c++) {
+            rows[c] = expander_rows[c];
+        }
+    }
+    return columns;
+}
+
+#endif
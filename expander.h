@@ -0,0 +1,23 @@
+#ifndef EXPANDER_H
+#define EXPANDER_H
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "matrix.h"
+
+// Columns of the matrix behind an MCP23017 port expander, they come after
+// the NUM_LOCAL_COLS columns on the MCU. Columns are on GPA0-7 and rows on
+// GPB0-7: the selected column is driven low, the others float, and the rows
+// are read back through the pull-ups of the expander.
+
+void expander_init();
+// Starts a sweep over the expander columns in the background unless one is
+// still running. While the expander is not responding, a new attempt is only
+// made every EXPANDER_RETRY_MS.
+void expander_start_sweep();
+// Returns the columns (bit c for expander column c) read since the last
+// call and clears them, rows holds the raw reads of all expander columns.
+// Keys of an expander which stopped responding read as released.
+uint8_t expander_take_fresh(matrix_rows_t *rows);
+
+#endif
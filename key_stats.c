@@ -0,0 +1,93 @@
+#include "key_stats.h"
+
+#include <avr/eeprom.h>
+
+#include "timer.h"
+
+#define KEY_STATS_MAGIC 0x4B
+
+key_stats_t key_stats[NUM_KEYS];
+// Time of the last press of each key, in ms
+static uint32_t last_press[NUM_KEYS];
+
+static uint8_t EEMEM ee_key_stats_magic;
+static key_stats_t EEMEM ee_key_stats[NUM_KEYS];
+
+static bool saving = false;
+static uint16_t save_offset = 0;
+static uint32_t last_save = 0;
+
+void key_stats_init() {
+    if (KEY_STATS_SAVE_INTERVAL_MS > 0 &&
+        eeprom_read_byte(&ee_key_stats_magic) == KEY_STATS_MAGIC) {
+        eeprom_read_block(key_stats, ee_key_stats, sizeof(key_stats));
+    } else {
+        key_stats_reset();
+    }
+}
+
+void key_stats_reset() {
+    for (uint16_t k = 0; k < NUM_KEYS; k++) {
+        key_stats[k].presses = 0;
+        key_stats[k].bounces = 0;
+        key_stats[k].min_interval = 0xFF;
+    }
+}
+
+void key_stats_task() {
+    if (KEY_STATS_SAVE_INTERVAL_MS == 0) {
+        return;
+    }
+
+    if (!saving) {
+        if (timer_millis() - last_save >= KEY_STATS_SAVE_INTERVAL_MS) {
+            saving = true;
+            save_offset = 0;
+        }
+        return;
+    }
+
+    if (!eeprom_is_ready()) {
+        return;
+    }
+
+    if (save_offset < sizeof(key_stats)) {
+        // Only writes the byte if it changed, to spare the EEPROM
+        eeprom_update_byte((uint8_t *)ee_key_stats + save_offset,
+                           ((uint8_t *)key_stats)[save_offset]);
+        save_offset++;
+    } else {
+        eeprom_update_byte(&ee_key_stats_magic, KEY_STATS_MAGIC);
+        saving = false;
+        last_save = timer_millis();
+    }
+}
+
+void key_stats_count_bounces(uint8_t col, matrix_rows_t rows) {
+    key_stats_t *stats = &key_stats[col * NUM_ROWS];
+    for (uint8_t j = 0; j < NUM_ROWS; j++) {
+        if ((rows & ROW_BIT(j)) && stats[j].bounces < UINT16_MAX) {
+            stats[j].bounces++;
+        }
+    }
+}
+
+void key_stats_count_presses(uint8_t col, matrix_rows_t rows) {
+    const uint16_t k = col * NUM_ROWS;
+    const uint32_t time = timer_millis();
+    for (uint8_t j = 0; j < NUM_ROWS; j++) {
+        if (!(rows & ROW_BIT(j))) {
+            continue;
+        }
+
+        key_stats_t *stats = &key_stats[k + j];
+        if (stats->presses < UINT16_MAX) {
+            stats->presses++;
+        }
+        const uint32_t interval = time - last_press[k + j];
+        if (last_press[k + j] != 0 && interval < stats->min_interval) {
+            stats->min_interval = interval;
+        }
+        last_press[k + j] = time;
+    }
+}
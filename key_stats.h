@@ -0,0 +1,27 @@
+#ifndef KEY_STATS_H
+#define KEY_STATS_H
+#include <stdint.h>
+
+#include "matrix.h"
+
+// Switch health counters of a single key. All counters saturate instead of
+// wrapping around. Keys are indexed by col * NUM_ROWS + row.
+typedef struct {
+    uint16_t presses;      // Debounced presses
+    uint16_t bounces;      // Raw changes rejected by the debounce
+    uint8_t min_interval;  // Shortest time between two presses in ms, 0xFF
+                           // if not observed (or longer than 254ms)
+} __attribute__((packed)) key_stats_t;
+
+extern key_stats_t key_stats[NUM_KEYS];
+
+void key_stats_init();
+void key_stats_reset();
+// Periodically persists the counters to the EEPROM, one byte per call so it
+// never waits for an EEPROM write to finish
+void key_stats_task();
+
+void key_stats_count_bounces(uint8_t col, matrix_rows_t rows);
+void key_stats_count_presses(uint8_t col, matrix_rows_t rows);
+
+#endif
@@ -0,0 +1,62 @@
+#ifndef KEYMAP_H
+#define KEYMAP_H
+#include <avr/pgmspace.h>
+#include <stdint.h>
+
+#include "combo.h"
+#include "matrix.h"
+
+// The tables are generated from keymap.txt by keymapc.py (keymap_table.c)
+
+#define KEYCLASS_NONE 0
+#define KEYCLASS_KEY 1
+#define KEYCLASS_MODIFIER 2
+#define KEYCLASS_MOUSE 3  // keycode is one of the MS_ codes of mousekey.h
+
+// Every key is a single byte in flash, its class follows from the range it
+// is in, so the class and the modifier bit are cheap to decode on the fly:
+//   0x00         KEYCLASS_NONE, unused position
+//   0x01-0xDF    KEYCLASS_KEY, the keycode for the key array of the report
+//   0xE0-0xE7    KEYCLASS_MODIFIER, the HID usage of the modifier
+//   0xF0-0xFF    KEYCLASS_MOUSE, KEYMAP_MOUSE + the MS_ code
+#define KEYMAP_MODIFIER 0xE0
+#define KEYMAP_MOUSE 0xF0
+
+// Action of each key, indexed by col * NUM_ROWS + row
+extern const uint8_t keymap[NUM_KEYS] PROGMEM;
+extern const combo_t combos[] PROGMEM;
+extern const uint8_t num_combos;
+
+__attribute__((always_inline, warn_unused_result)) static inline uint8_t
+keymap_class(uint16_t key) {
+    const uint8_t code = pgm_read_byte(&keymap[key]);
+    if (code == 0) {
+        return KEYCLASS_NONE;
+    }
+    if (code < KEYMAP_MODIFIER) {
+        return KEYCLASS_KEY;
+    }
+    return code < KEYMAP_MOUSE ? KEYCLASS_MODIFIER : KEYCLASS_MOUSE;
+}
+
+// Keycode for the report, the MS_ code of a mouse key, 0 for a modifier
+__attribute__((always_inline, warn_unused_result)) static inline uint8_t
+keymap_keycode(uint16_t key) {
+    const uint8_t code = pgm_read_byte(&keymap[key]);
+    if (code < KEYMAP_MODIFIER) {
+        return code;
+    }
+    return code >= KEYMAP_MOUSE ? code - KEYMAP_MOUSE : 0;
+}
+
+// Bit to set in the modifier byte of the report
+__attribute__((always_inline, warn_unused_result)) static inline uint8_t
+keymap_modifiers(uint16_t key) {
+    const uint8_t code = pgm_read_byte(&keymap[key]);
+    if (code < KEYMAP_MODIFIER || code >= KEYMAP_MOUSE) {
+        return 0;
+    }
+    return 1 << (code - KEYMAP_MODIFIER);
+}
+
+#endif
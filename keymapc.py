@@ -0,0 +1,227 @@
+"""
+Keymap compiler - turns a declarative keymap (keymap.txt) into the flash
+tables used by the firmware (keymap_table.c).
+
+Every key is packed into a single byte whose range gives its class (see
+keymap.h), a third of the (class, keycode, modifier mask) action record it
+decodes to. The sizes of the tables are reported on stderr. The keymap is
+validated against the matrix geometry in board.h and the keycodes in keys.h,
+so mistakes are caught at build time rather than on a flashed board.
+
+usage: python3 keymapc.py keymap.txt > keymap_table.c
+"""
+import os
+import re
+import sys
+
+# Key classes, see keymap.h
+KEYCLASS_NONE = 0
+KEYCLASS_KEY = 1
+KEYCLASS_MODIFIER = 2
+KEYCLASS_MOUSE = 3
+
+# Mouse keys, see mousekey.h
+MOUSE_KEYS = {
+    'MS_UP': 0,
+    'MS_DOWN': 1,
+    'MS_LEFT': 2,
+    'MS_RIGHT': 3,
+    'MS_WH_UP': 4,
+    'MS_WH_DOWN': 5,
+    'MS_BTN1': 6,
+    'MS_BTN2': 7,
+    'MS_BTN3': 8,
+}
+
+# Highest usage declared in the HID report descriptor (descriptors.h)
+MAX_KEYCODE = 0x65
+
+# Packed key codes, see keymap.h
+KEYMAP_MODIFIER = 0xe0
+KEYMAP_MOUSE = 0xf0
+
+# Size of an action record, which is what a packed key decodes to
+ACTION_SIZE = 3
+
+
+class KeymapError(Exception):
+    pass
+
+
+def read_defines(path, pattern):
+    with open(path) as f:
+        return {m.group(1): int(m.group(2), 0)
+                for m in re.finditer(pattern, f.read(), re.MULTILINE)}
+
+
+def read_board(path):
+    defines = read_defines(path, r'^#define (\w+) (\d+)\s*$')
+    try:
+        return defines['NUM_ROWS'], defines['NUM_COLS'], defines['MAX_COMBOS']
+    except KeyError as e:
+        raise KeymapError(f'{path}: missing {e.args[0]}')
+
+
+def read_keycodes(path):
+    return read_defines(path, r'^#define KEY_(\w+) (0x[0-9a-fA-F]+)')
+
+
+def parse_sections(path):
+    sections = {}
+    current = None
+    with open(path) as f:
+        for lineno, line in enumerate(f, 1):
+            line = line.split('#', 1)[0].strip()
+            if not line:
+                continue
+            m = re.fullmatch(r'\[(\w+)\]', line)
+            if m:
+                current = sections.setdefault(m.group(1), [])
+            elif current is None:
+                raise KeymapError(f'{path}:{lineno}: expected a [section]')
+            else:
+                current.append((lineno, line))
+    return sections
+
+
+class Compiler:
+    def __init__(self, path, num_rows, num_cols, max_combos, keycodes):
+        self.path = path
+        self.num_rows = num_rows
+        self.num_cols = num_cols
+        self.max_combos = max_combos
+        self.keycodes = keycodes
+
+    def error(self, lineno, message):
+        raise KeymapError(f'{self.path}:{lineno}: {message}')
+
+    def action(self, lineno, name):
+        """ Returns the (class, keycode, modifiers) record of a key name """
+        if name == '_':
+            return (KEYCLASS_NONE, 0, 0)
+        if name in MOUSE_KEYS:
+            return (KEYCLASS_MOUSE, MOUSE_KEYS[name], 0)
+        if name not in self.keycodes:
+            self.error(lineno, f'unknown key {name}')
+
+        code = self.keycodes[name]
+        if 0xe0 <= code <= 0xe7:
+            return (KEYCLASS_MODIFIER, 0, 1 << (code - 0xe0))
+        if code > MAX_KEYCODE:
+            self.error(lineno, f'{name} (0x{code:02x}) is not covered by the '
+                       f'HID report descriptor')
+        return (KEYCLASS_KEY, code, 0)
+
+    def layout(self, lines):
+        if len(lines) != self.num_rows:
+            self.error(lines[-1][0] if lines else 0,
+                       f'layout has {len(lines)} rows, the matrix has '
+                       f'{self.num_rows}')
+        rows = []
+        for lineno, line in lines:
+            names = line.split()
+            if len(names) != self.num_cols:
+                self.error(lineno, f'row has {len(names)} keys, the matrix '
+                           f'has {self.num_cols} columns')
+            rows.append([(name, self.action(lineno, name)) for name in names])
+
+        # Keys are indexed by col * NUM_ROWS + row, see matrix.h
+        return [rows[row][col]
+                for col in range(self.num_cols)
+                for row in range(self.num_rows)]
+
+    def combos(self, lines):
+        if len(lines) > self.max_combos:
+            self.error(lines[-1][0], f'{len(lines)} combos, at most '
+                       f'MAX_COMBOS ({self.max_combos}) are supported')
+        combos = []
+        seen = set()
+        for lineno, line in lines:
+            keys, sep, name = line.partition('=')
+            if not sep:
+                self.error(lineno, 'expected "row,col row,col ... = KEY"')
+            positions = set()
+            for key in keys.split():
+                m = re.fullmatch(r'(\d+),(\d+)', key)
+                if not m:
+                    self.error(lineno, f'invalid key position {key}')
+                row, col = int(m.group(1)), int(m.group(2))
+                if row >= self.num_rows or col >= self.num_cols:
+                    self.error(lineno, f'{key} is outside of the matrix')
+                positions.add((row, col))
+            if len(positions) < 2:
+                self.error(lineno, 'a combo needs at least two keys')
+            if frozenset(positions) in seen:
+                self.error(lineno, 'duplicate combo')
+            seen.add(frozenset(positions))
+
+            name = name.strip()
+            cls, keycode, _ = self.action(lineno, name)
+            if cls != KEYCLASS_KEY:
+                self.error(lineno, 'a combo must send a regular key')
+
+            masks = [0] * self.num_cols
+            for row, col in positions:
+                masks[col] |= 1 << row
+            combos.append((masks, name))
+        return combos
+
+
+def pack(action):
+    """ Packs a (class, keycode, modifiers) record into its keymap byte """
+    cls, keycode, modifiers = action
+    if cls == KEYCLASS_NONE:
+        return 0
+    if cls == KEYCLASS_MODIFIER:
+        return KEYMAP_MODIFIER + modifiers.bit_length() - 1
+    if cls == KEYCLASS_MOUSE:
+        return KEYMAP_MOUSE + keycode
+    return keycode
+
+
+def generate(source, keys, combos):
+    out = [f'// Generated by keymapc.py from {source}, do not edit.',
+           '#include "keymap.h"',
+           '',
+           'const uint8_t keymap[NUM_KEYS] PROGMEM = {']
+    for k, (name, action) in enumerate(keys):
+        out.append(f'    0x{pack(action):02x},  // {k}: {name}')
+    out.append('};')
+    out.append('')
+    # An empty initializer is not valid C, keep at least one (unused) entry
+    out.append(f'const combo_t combos[{max(len(combos), 1)}] PROGMEM = {{')
+    for masks, name in combos:
+        keys = ', '.join(f'0x{m:02x}' for m in masks)
+        out.append(f'    {{.keys = {{{keys}}}, .keycode = KEY_{name}}},')
+    out.append('};')
+    out.append(f'const uint8_t num_combos = {len(combos)};')
+    return '\n'.join(out) + '\n'
+
+
+def main():
+    if len(sys.argv) != 2:
+        sys.exit(__doc__.strip().splitlines()[-1])
+
+    path = sys.argv[1]
+    root = os.path.dirname(os.path.abspath(__file__))
+    try:
+        num_rows, num_cols, max_combos = read_board(
+            os.path.join(root, 'board.h'))
+        keycodes = read_keycodes(os.path.join(root, 'keys.h'))
+        sections = parse_sections(path)
+        compiler = Compiler(path, num_rows, num_cols, max_combos, keycodes)
+        if 'layout' not in sections:
+            raise KeymapError(f'{path}: missing [layout] section')
+        keys = compiler.layout(sections['layout'])
+        combos = compiler.combos(sections.get('combos', []))
+    except KeymapError as e:
+        sys.exit(f'error: {e}')
+
+    sys.stdout.write(generate(os.path.basename(path), keys, combos))
+    combo_size = len(combos) * (num_cols * (2 if num_rows > 8 else 1) + 1)
+    sys.stderr.write(f'keymap: {len(keys)} bytes ({len(keys) * ACTION_SIZE} '
+                     f'as action records), combos: {combo_size} bytes\n')
+
+
+if __name__ == '__main__':
+    main()
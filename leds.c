@@ -0,0 +1,31 @@
+#include "leds.h"
+
+uint8_t keyboard_leds = 0;
+
+#define LED_MASK                                          \
+    ((1 << LED_NUM_LOCK_PIN) | (1 << LED_CAPS_LOCK_PIN) | \
+     (1 << LED_SCROLL_LOCK_PIN))
+
+void leds_init() {
+    DDRD |= LED_MASK;
+    PORTD &= ~LED_MASK;
+}
+
+void leds_set(uint8_t report) {
+    keyboard_leds = report;
+}
+
+void leds_task() {
+    const uint8_t report = keyboard_leds;
+    uint8_t port = PORTD & ~LED_MASK;
+    if (report & LED_NUM_LOCK) {
+        port |= (1 << LED_NUM_LOCK_PIN);
+    }
+    if (report & LED_CAPS_LOCK) {
+        port |= (1 << LED_CAPS_LOCK_PIN);
+    }
+    if (report & LED_SCROLL_LOCK) {
+        port |= (1 << LED_SCROLL_LOCK_PIN);
+    }
+    PORTD = port;
+}
@@ -0,0 +1,24 @@
+#ifndef LEDS_H
+#define LEDS_H
+#include <avr/io.h>
+#include <stdint.h>
+
+#include "board.h"
+
+// Bits of the LED output report - HID 1.11 Appendix B.1
+#define LED_NUM_LOCK (1 << 0)
+#define LED_CAPS_LOCK (1 << 1)
+#define LED_SCROLL_LOCK (1 << 2)
+#define LED_COMPOSE (1 << 3)
+#define LED_KANA (1 << 4)
+
+// Last LED output report received from the host
+extern uint8_t keyboard_leds;
+
+void leds_init();
+// Stores the report received from the host, the LEDs follow on the next run
+// of leds_task()
+void leds_set(uint8_t report);
+void leds_task();
+
+#endif
@@ -1,34 +1,286 @@
+import os
+import struct
+import sys
+import tty
+
 import usb.core
 import usb.util
 
+# Vendor requests, see blink.h
+VENDOR_GET_KEY_STATS = 0x01
+VENDOR_RESET_KEY_STATS = 0x02
+VENDOR_GET_BOOT_TIMES = 0x03
+VENDOR_GET_TASK_STATS = 0x04
+VENDOR_RESET_TASK_STATS = 0x05
+VENDOR_GET_SCAN_RATES = 0x06
+VENDOR_GET_ANALOG_KEYS = 0x07
+VENDOR_SET_ACTUATION = 0x08
+VENDOR_GET_PROFILE = 0x09
+VENDOR_RESET_PROFILE = 0x0A
+VENDOR_GET_MEMORY = 0x0B
+
+BOOT_MILESTONES = ['reset', 'PLL lock', 'bus reset', 'SET_ADDRESS',
+                   'SET_CONFIGURATION']
+
+# Scheduler tasks, see sched.h
+TASKS = ['scan', 'report', 'leds', 'housekeeping', 'rgb', 'ps2']
+
+# Profiler points, see profile.h
+PROFILE_POINTS = ['USB_GEN', 'USB_COM', 'matrix_scan', 'debounce', 'report',
+                  'rgb render', 'rgb output']
+
+# Debug console records, see console.h
+CONSOLE_EVENTS = ['dropped', 'key down', 'key up', 'scan rate']
+CONSOLE_RECORD = '<BBHI'
+
+F_CPU = 16000000
+
+# Rough supply current of the MCU when busy and when sleeping in idle mode
+# (ATmega32u4 at 16mhz/5V), replace with measurements of the actual board
+ACTIVE_CURRENT_MA = 10.0
+IDLE_CURRENT_MA = 4.0
+
+# Matrix geometry, see board.h
+NUM_ROWS = 2
+NUM_COLS = 4
+
+# Thresholds used to flag a switch as failing
+MAX_BOUNCE_RATIO = 0.05
+MIN_PRESS_INTERVAL_MS = 30
+
 
 def hid_get_report(dev):
     """ Implements HID GetReport via USB control transfer """
     return dev.ctrl_transfer(
         0xA1,  # REQUEST_TYPE_CLASS | RECIPIENT_INTERFACE | ENDPOINT_IN
         1,     # GET_REPORT
-        0x200, # "Vendor" Descriptor Type + 0 Descriptor Index
+        0x100, # Input report, report ID 0
         0,     # USB interface № 0
         64     # max reply size
     )
 
 
+def vendor_in(dev, request, length):
+    return dev.ctrl_transfer(
+        0xC0,  # REQUEST_TYPE_VENDOR | RECIPIENT_DEVICE | ENDPOINT_IN
+        request, 0, 0, length)
+
+
+def vendor_out(dev, request, value=0, index=0):
+    return dev.ctrl_transfer(
+        0x40,  # REQUEST_TYPE_VENDOR | RECIPIENT_DEVICE | ENDPOINT_OUT
+        request, value, index)
+
+
+def get_key_stats(dev):
+    """ Returns (presses, bounces, min_interval) for every key """
+    fmt = '<HHB'
+    size = struct.calcsize(fmt)
+    data = bytes(vendor_in(dev, VENDOR_GET_KEY_STATS,
+                           NUM_ROWS * NUM_COLS * size))
+    return [struct.unpack_from(fmt, data, i * size)
+            for i in range(len(data) // size)]
+
+
+def print_key_stats(dev):
+    for k, (presses, bounces, min_interval) in enumerate(get_key_stats(dev)):
+        col, row = divmod(k, NUM_ROWS)
+        problems = []
+        if presses and bounces / presses > MAX_BOUNCE_RATIO:
+            problems.append('bouncing')
+        if min_interval < MIN_PRESS_INTERVAL_MS:
+            problems.append('chattering')
+        interval = '-' if min_interval == 0xFF else f'{min_interval}ms'
+        print(f'row {row} col {col}: {presses:5} presses, {bounces:5} bounces, '
+              f'min interval {interval:>5} {" ".join(problems)}')
+
+
+def print_boot_times(dev):
+    data = bytes(vendor_in(dev, VENDOR_GET_BOOT_TIMES,
+                           4 * len(BOOT_MILESTONES)))
+    times = struct.unpack(f'<{len(BOOT_MILESTONES)}I', data)
+    for name, time in zip(BOOT_MILESTONES, times):
+        print(f'{name:>18}: {time / 1000:10.3f}ms')
+    enumeration = (times[-1] - times[2]) % 2**32
+    print(f'bus reset to configured: {enumeration / 1000:.3f}ms')
+
+
+def print_task_stats(dev):
+    data = bytes(vendor_in(dev, VENDOR_GET_TASK_STATS, 6 * len(TASKS)))
+    print(f'{"task":>14} {"last":>8} {"max":>8} {"avg":>8}  (cycles)')
+    for name, (last, max_, avg) in zip(TASKS, struct.iter_unpack('<3H', data)):
+        print(f'{name:>14} {last:8} {max_:8} {avg:8}  '
+              f'max {max_ * 1e6 / F_CPU:7.1f}us')
+
+
+def get_scan_rates(dev):
+    """ Scan periods in ms and the time spent at each scan rate. The periods
+    are the full rate (0) followed by SCAN_RATES of board.h and None for the
+    time spent waiting for a pin change (MATRIX_PCINT_WAKEUP) """
+    data = bytes(vendor_in(dev, VENDOR_GET_SCAN_RATES, 255))
+    count = data[0]
+    periods = list(data[1:1 + count]) + [None]
+    residency = struct.unpack_from(f'<{count + 1}I', data, 1 + count)
+    return periods, residency
+
+
+def print_scan_rates(dev):
+    """ Time spent at each scan rate and the estimated current draw """
+    periods, residency = get_scan_rates(dev)
+    stats = list(struct.iter_unpack('<3H',
+                 bytes(vendor_in(dev, VENDOR_GET_TASK_STATS, 6 * len(TASKS)))))
+    # Cycles of a scan and of the report update following it
+    cycles = stats[0][2] + stats[1][2]
+
+    total = sum(residency) or 1
+    average = 0
+    for period, time in zip(periods, residency):
+        if period is None:
+            duty = 0.0  # Only the ms tick wakes the CPU
+            rate = 'pcint'
+        elif period == 0:
+            duty = 1.0  # The main loop never sleeps at full rate
+            rate = 'full'
+        else:
+            duty = min(1.0, cycles / (period * F_CPU / 1000))
+            rate = f'{1000 / period:.0f}Hz'
+        current = IDLE_CURRENT_MA + (ACTIVE_CURRENT_MA - IDLE_CURRENT_MA) * duty
+        average += current * time / total
+        print(f'{rate:>6}: {time / 1000:10.1f}s ({100 * time / total:5.1f}%), '
+              f'cpu {100 * duty:5.1f}%, ~{current:.1f}mA')
+    print(f'average: ~{average:.1f}mA')
+
+
+def print_profile(dev):
+    data = bytes(vendor_in(dev, VENDOR_GET_PROFILE, 12 * len(PROFILE_POINTS)))
+    print(f'{"":>12} {"min":>8} {"max":>8} {"mean":>10} {"count":>10}  (cycles)')
+    for name, (min_, max_, total, count) in zip(
+            PROFILE_POINTS, struct.iter_unpack('<HHII', data)):
+        if count == 0:
+            print(f'{name:>12} {"-":>8}')
+            continue
+        mean = total / count
+        print(f'{name:>12} {min_:8} {max_:8} {mean:10.1f} {count:10}  '
+              f'max {max_ * 1e6 / F_CPU:7.1f}us')
+
+
+def print_memory(dev):
+    """ Static RAM and the stack depth measured by stack painting """
+    static, peak, now, free = struct.unpack(
+        '<4H', bytes(vendor_in(dev, VENDOR_GET_MEMORY, 8)))
+    print(f'static data: {static:5} bytes')
+    print(f'stack:       {now:5} bytes, peak {peak}')
+    print(f'free:        {free:5} bytes at the peak of the stack')
+
+
+def print_analog_keys(dev):
+    """ Calibration and travel of the analog (MATRIX_ANALOG) keys """
+    fmt = '<HHBBBB'
+    size = struct.calcsize(fmt)
+    data = bytes(vendor_in(dev, VENDOR_GET_ANALOG_KEYS,
+                           NUM_ROWS * NUM_COLS * size))
+    for k in range(len(data) // size):
+        rest, bottom, travel, actuation, _, flags = struct.unpack_from(
+            fmt, data, k * size)
+        col, row = divmod(k, NUM_ROWS)
+        state = 'pressed' if flags & 0x02 else ''
+        print(f'row {row} col {col}: rest {rest:4}, bottom {bottom:4}, '
+              f'travel {travel:3}/255, actuation {actuation:3} {state}')
+
+
+def format_record(event, arg, value, time, periods=None):
+    name = (CONSOLE_EVENTS[event] if event < len(CONSOLE_EVENTS)
+            else f'event {event}')
+    if name == 'dropped':
+        detail = f'{value} records'
+    elif name in ('key down', 'key up'):
+        col, row = divmod(value, NUM_ROWS)
+        detail = f'row {row} col {col}'
+    elif name == 'scan rate':
+        if periods is None or arg >= len(periods):
+            detail = f'rate {arg}'  # Periods are only known from the device
+        else:
+            period = periods[arg]
+            detail = ('pcint' if period is None else
+                      'full' if period == 0 else f'{1000 / period:.0f}Hz')
+    else:
+        detail = f'arg {arg}, value {value}'
+    return f'{time / 1000:10.3f}s {name:>10}: {detail}'
+
+
+def console(path, periods=None):
+    """ Prints the log records of the debug console (DEBUG_CONSOLE) """
+    fd = os.open(path, os.O_RDWR | os.O_NOCTTY)
+    tty.setraw(fd)  # Opening the port raises DTR, which enables the log
+    size = struct.calcsize(CONSOLE_RECORD)
+    buffer = b''
+    try:
+        while True:
+            buffer += os.read(fd, 64)
+            while len(buffer) >= size:
+                print(format_record(*struct.unpack_from(CONSOLE_RECORD,
+                                                        buffer), periods))
+                buffer = buffer[size:]
+    except KeyboardInterrupt:
+        os.close(fd)
+
+
+command = sys.argv[1] if len(sys.argv) > 1 else 'info'
+if command == 'console':
+    # main.py console [TTY], does not need pyusb access to the device, the scan
+    # rates are only named when it is available
+    periods = None
+    try:
+        dev = usb.core.find(idVendor=0x03eb, idProduct=0x2ff4)
+        if dev is not None:
+            periods = get_scan_rates(dev)[0]
+    except usb.core.USBError:
+        pass
+    console(sys.argv[2] if len(sys.argv) > 2 else '/dev/ttyACM0', periods)
+    sys.exit()
+
 dev = usb.core.find(idVendor=0x03eb, idProduct=0x2ff4)
-ep = dev[0].interfaces()[0].endpoints()[0]
 
-i = dev[0].interfaces()[0].bInterfaceNumber
+if command == 'stats':
+    print_key_stats(dev)
+elif command == 'reset-stats':
+    vendor_out(dev, VENDOR_RESET_KEY_STATS)
+elif command == 'boot-times':
+    print_boot_times(dev)
+elif command == 'tasks':
+    print_task_stats(dev)
+elif command == 'reset-tasks':
+    vendor_out(dev, VENDOR_RESET_TASK_STATS)
+elif command == 'scan-rates':
+    print_scan_rates(dev)
+elif command == 'profile':
+    print_profile(dev)
+elif command == 'reset-profile':
+    vendor_out(dev, VENDOR_RESET_PROFILE)
+elif command == 'memory':
+    print_memory(dev)
+elif command == 'analog':
+    print_analog_keys(dev)
+elif command == 'actuation':
+    # main.py actuation ROW COL TRAVEL
+    row, col, travel = map(int, sys.argv[2:5])
+    vendor_out(dev, VENDOR_SET_ACTUATION, col * NUM_ROWS + row, travel)
+else:
+    ep = dev[0].interfaces()[0].endpoints()[0]
+
+    i = dev[0].interfaces()[0].bInterfaceNumber
 
-# dev.reset()
+    # dev.reset()
 
-# if dev.is_kernel_driver_active(i):
-#     dev.detach_kernel_driver(i)
+    # if dev.is_kernel_driver_active(i):
+    #     dev.detach_kernel_driver(i)
 
-# dev.set_configuration()
-print(dev.get_active_configuration())
+    # dev.set_configuration()
+    print(dev.get_active_configuration())
 
-print(hid_get_report(dev))
-# while True:
-#     try:
-#         print(dev.read(0x81, 8, 100))
-#     except usb.core.USBTimeoutError:
-#         pass
+    print(hid_get_report(dev))
+    # while True:
+    #     try:
+    #         print(dev.read(0x81, 8, 100))
+    #     except usb.core.USBTimeoutError:
+    #         pass
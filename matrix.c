@@ -1,130 +1,356 @@
 #include "matrix.h"
 
-#define NUM_ROWS 2
-#define NUM_COLS 4
+#include "analog.h"
+#include "expander.h"
+#include "key_stats.h"
+#include "profile.h"
+#include "timer.h"
 
-typedef struct {
-    uint8_t modifiers;
-    bool is_overflow;
-    uint8_t pressed_keys[NUM_ROWS * NUM_COLS];
-} keyboard_state_t;
+#if (MATRIX_ANALOG || MATRIX_SR_ROWS) && MATRIX_PCINT_WAKEUP
+#error "The pin change wakeup needs rows on port B, disable MATRIX_PCINT_WAKEUP"
+#endif
+#if MATRIX_ANALOG && MATRIX_SHIFT_REGISTER
+#error "Analog keys need the columns on port B"
+#endif
+#if EXPANDER_COLS && (MATRIX_ANALOG || MATRIX_PCINT_WAKEUP)
+#error "The expander columns can only be scanned digitally, without wakeup"
+#endif
+#if (!MATRIX_SHIFT_REGISTER && NUM_LOCAL_COLS > 8) || \
+    (!MATRIX_SR_ROWS && NUM_ROWS > 8)
+#error "Port B only has 8 pins, use the shift registers for a larger matrix"
+#endif
 
-uint8_t keyboard_modifiers = 0;
-uint8_t keyboard_keys[] = {0, 0, 0, 0, 0, 0, 0, 0};
+// Last raw read and the debounced state of each column
+matrix_rows_t matrix_raw[NUM_COLS];
+matrix_rows_t matrix_state[NUM_COLS];
+uint8_t debounce_counters[NUM_COLS];
 
-uint8_t col_pins[] = {PORTB0, PORTB1, PORTB2, PORTB3};
-uint8_t row_pins[] = {PORTB4, PORTB5};
-uint8_t keyboard_layout[NUM_ROWS][NUM_COLS] = {{0, 0, 0, 0}, {0, 0, 0, 0}};
+bool matrix_idle = true;
 
-bool keyboard_state_raw[NUM_ROWS][NUM_COLS] = {{0, 0, 0, 0}, {0, 0, 0, 0}};
-bool keyboard_state[NUM_ROWS][NUM_COLS] = {{0, 0, 0, 0}, {0, 0, 0, 0}};
-uint8_t keyboard_pressed_keys[8] = {0, 0, 0, 0, 0, 0, 0, 0};
-// uint8_t keyboard_report[6+8] = {0, 0, 0, 0, 0, 0, 0, 0};
+const uint16_t matrix_settle_cycles = MATRIX_SETTLE_US * CYCLES_PER_US;
 
-keyboard_state_t _keyboard_state = {.modifiers = 0,
-                                    .is_overflow = false,
-                                    .pressed_keys = {0, 0, 0, 0, 0, 0, 0, 0}};
+#if MATRIX_SHIFT_REGISTER
+#define SR_COL_BYTES ((NUM_LOCAL_COLS + 7) / 8)
+#if MATRIX_SR_ROWS
+#define SR_ROW_BYTES ((NUM_ROWS + 7) / 8)
+#else
+#define SR_ROW_BYTES 0
+#endif
+#define SR_BYTES (SR_COL_BYTES > SR_ROW_BYTES ? SR_COL_BYTES : SR_ROW_BYTES)
+// Column argument of shift_columns() which drives all of them, any other
+// value past the last column drives none
+#define SR_ALL_COLUMNS 0xFF
+
+#define ALL_ROWS ((matrix_rows_t)(~(matrix_rows_t)0) >> \
+                  (sizeof(matrix_rows_t) * 8 - NUM_ROWS))
+
+__attribute__((always_inline)) static inline uint8_t spi_transfer(
+    uint8_t data) {
+    SPDR = data;
+    while (!(SPSR & (1 << SPIF)))
+        ;
+    return SPDR;
+}
+
+// Shifts the pattern driving only column `col` into the 595s and returns
+// what the 165s shifted in meanwhile. The outputs only change with
+// latch_columns().
+static matrix_rows_t shift_columns(uint8_t col) {
+    matrix_rows_t rows = 0;
+    for (uint8_t b = 0; b < SR_BYTES; b++) {
+        // The first byte ends up in the register farthest from the MCU, any
+        // bytes beyond the chain just fall off its end
+        const uint8_t reg = SR_BYTES - 1 - b;
+        uint8_t pattern = 0;
+        if (col == SR_ALL_COLUMNS) {
+            pattern = 0xFF;
+        } else if (col < NUM_LOCAL_COLS && (col >> 3) == reg) {
+            pattern = 1 << (col & 7);
+        }
+
+        const uint8_t in = spi_transfer(pattern);
+        if (b < SR_ROW_BYTES) {
+            rows |= (matrix_rows_t)in << (8 * b);
+        }
+    }
+    return rows;
+}
+
+__attribute__((always_inline)) static inline void latch_columns() {
+    set_high(SR_LATCH_PIN);
+    set_low(SR_LATCH_PIN);
+}
+
+// Parallel load of the row inputs into the 165s
+__attribute__((always_inline)) static inline void load_rows() {
+    set_low(SR_LOAD_PIN);
+    set_high(SR_LOAD_PIN);
+}
+#endif
 
 void init_pins() {
-    for (uint8_t i = 0; i < NUM_COLS; i++) {
+#if MATRIX_SHIFT_REGISTER
+    // PB0 is the SPI slave select, it has to be an output in master mode
+    set_as_output(PORTB0);
+    set_as_output(PORTB1);  // SCK
+    set_as_output(PORTB2);  // MOSI
+    set_as_input(PORTB3);   // MISO
+    set_as_output(SR_LATCH_PIN);
+    set_low(SR_LATCH_PIN);
+#if MATRIX_SR_ROWS
+    set_as_output(SR_LOAD_PIN);
+    set_high(SR_LOAD_PIN);
+#endif
+    // Master, mode 0, MSB first, clk/2
+    SPCR = (1 << SPE) | (1 << MSTR);
+    SPSR = (1 << SPI2X);
+    shift_columns(NUM_LOCAL_COLS);
+    latch_columns();
+#else
+    for (uint8_t i = 0; i < NUM_LOCAL_COLS; i++) {
         set_as_output(col_pins[i]);
         set_low(col_pins[i]);
     }
+#endif
+
+#if EXPANDER_COLS
+    expander_init();
+#endif
 
+#if MATRIX_ANALOG
+    analog_init();
+#elif !MATRIX_SR_ROWS
     for (uint8_t i = 0; i < NUM_ROWS; i++) {
         set_as_input(row_pins[i]);
     }
+#endif
 }
 
+#if MATRIX_ANALOG
 bool matrix_scan() {
+    return analog_scan();
+}
+#else
+__attribute__((always_inline)) static inline matrix_rows_t read_rows() {
+    const uint8_t pins = PINB;  // All rows are on port B, sample them at once
+    matrix_rows_t rows = 0;
+    MATRIX_UNROLL(j, NUM_ROWS, {
+        if (pins & (1 << row_pins[j])) {
+            rows |= ROW_BIT(j);
+        }
+    })
+    return rows;
+}
+
+// Debounces a single column, returns true if its debounced state changed.
+// A change in the raw read restarts the countdown, the new value is accepted
+// once it has been stable for DEBOUNCE_SCANS scans.
+static bool process_column(uint8_t col, matrix_rows_t rows) {
+    if (rows | matrix_raw[col] | debounce_counters[col]) {
+        matrix_idle = false;
+    }
+
+    if (rows != matrix_raw[col]) {
+#if KEY_STATS
+        // Keys which left the stable state and came back before the change
+        // was accepted bounced, other keys of the column may be real presses
+        if (debounce_counters[col] > 0) {
+            key_stats_count_bounces(col, (matrix_raw[col] ^ matrix_state[col]) &
+                                             ~(rows ^ matrix_state[col]));
+        }
+#endif
+        matrix_raw[col] = rows;
+        debounce_counters[col] = DEBOUNCE_SCANS;
+        return false;
+    }
+
+    if (debounce_counters[col] == 0) {
+        return false;
+    }
+
+    if (--debounce_counters[col] == 0 && matrix_state[col] != rows) {
+#if KEY_STATS
+        key_stats_count_presses(col, rows & ~matrix_state[col]);
+#endif
+        matrix_state[col] = rows;
+        return true;
+    }
+    return false;
+}
+
+#if MATRIX_SHIFT_REGISTER
+static bool scan_columns() {
     bool changed = false;
-    for (uint8_t i = 0; i < NUM_COLS; i++) {
-        set_high(col_pins[i]);
-        _delay_us(20);
-
-        for (uint8_t j = 0; j < NUM_ROWS; j++) {
-            const bool previous = keyboard_state_raw[j][i];
-            const bool current = read_pin(row_pins[j]);
-            keyboard_state_raw[j][i] = current;
-            if (previous != current) {
-                changed = true;
-            }
+
+    shift_columns(0);
+    latch_columns();
+    uint16_t strobed_at = timer_cycles();
+    // The 595s hold the pattern of the next column while the current one is
+    // driven, so switching columns is just a latch pulse
+    shift_columns(1);
+
+    for (uint8_t i = 0; i < NUM_LOCAL_COLS; i++) {
+        timer_wait_since(strobed_at, matrix_settle_cycles);
+#if MATRIX_SR_ROWS
+        load_rows();
+#else
+        const matrix_rows_t rows = read_rows();
+#endif
+        latch_columns();
+        strobed_at = timer_cycles();
+
+        // Shift out the column after the next one while this one is read and
+        // processed, and the next one settles
+#if MATRIX_SR_ROWS
+        const matrix_rows_t rows = shift_columns(i + 2) & ALL_ROWS;
+#else
+        shift_columns(i + 2);
+#endif
+
+        PROFILE_START(PROFILE_DEBOUNCE);
+        if (process_column(i, rows)) {
+            changed = true;
         }
+        PROFILE_END(PROFILE_DEBOUNCE);
+    }
+    return changed;
+}
+#elif MATRIX_PIPELINED_SCAN
+// Reads and processes column i, which is always a constant (MATRIX_UNROLL)
+__attribute__((always_inline)) static inline bool scan_column(
+    uint8_t i, uint16_t *strobed_at) {
+    // Only wait for whatever is left of the settle time, processing of the
+    // previous column has already used up some of it
+    timer_wait_since(*strobed_at, matrix_settle_cycles);
+    const matrix_rows_t rows = read_rows();
+    set_low(col_pins[i]);
 
-        set_low(col_pins[i]);
+    // Start strobing the next column so that it settles while we process
+    // this one
+    if (i + 1 < NUM_LOCAL_COLS) {
+        set_high(col_pins[i + 1]);
+        *strobed_at = timer_cycles();
     }
+
+    PROFILE_START(PROFILE_DEBOUNCE);
+    const bool changed = process_column(i, rows);
+    PROFILE_END(PROFILE_DEBOUNCE);
+    return changed;
+}
+
+static bool scan_columns() {
+    bool changed = false;
+
+    set_high(col_pins[0]);
+    uint16_t strobed_at = timer_cycles();
+
+    MATRIX_UNROLL(i, NUM_LOCAL_COLS, {
+        if (scan_column(i, &strobed_at)) {
+            changed = true;
+        }
+    })
+    return changed;
+}
+#else
+// Strobes, reads and processes column i, which is always a constant
+// (MATRIX_UNROLL)
+__attribute__((always_inline)) static inline bool scan_column(uint8_t i) {
+    set_high(col_pins[i]);
+    _delay_us(MATRIX_SETTLE_US);
+    const matrix_rows_t rows = read_rows();
+    set_low(col_pins[i]);
+
+    PROFILE_START(PROFILE_DEBOUNCE);
+    const bool changed = process_column(i, rows);
+    PROFILE_END(PROFILE_DEBOUNCE);
+    return changed;
+}
+
+static bool scan_columns() {
+    bool changed = false;
+    MATRIX_UNROLL(i, NUM_LOCAL_COLS, {
+        if (scan_column(i)) {
+            changed = true;
+        }
+    })
     return changed;
 }
+#endif
+
+#if EXPANDER_COLS
+// Debounces the expander columns which were read since the last scan
+static bool scan_expander() {
+    matrix_rows_t rows[EXPANDER_COLS];
+    const uint8_t fresh = expander_take_fresh(rows);
+    expander_start_sweep();
 
-void debounce() {}
-
-void _matrix_scan() {
-    const bool changed = matrix_scan();
-    debounce();
-
-    uint8_t k = 0;
-    for (uint8_t i = 0; i < NUM_COLS; i++) {
-        for (uint8_t j = 0; j < NUM_ROWS; j++) {
-            const uint8_t keycode = keyboard_layout[j][i];
-            const bool is_pressed = read_pin(row_pins[j]);
-            if (!is_pressed) {
-                if (is_modifier_key(keycode)) {
-                    keyboard_modifiers &= ~(1 << (keycode & ~0xe0));
-                } else {
-                    keyboard_keys[k] = 0;
-                }
-            } else {
-                if (is_modifier_key(keycode)) {
-                    keyboard_modifiers |= (1 << (keycode & ~0xe0));
-                } else {
-                    keyboard_keys[k] = keyboard_layout[j][i];
-                }
+    bool changed = false;
+    for (uint8_t c = 0; c < EXPANDER_COLS; c++) {
+        const uint8_t col = NUM_LOCAL_COLS + c;
+        if (fresh & (1 << c)) {
+            if (process_column(col, rows[c])) {
+                changed = true;
             }
-            k++;
+        } else if (matrix_raw[col] | debounce_counters[col]) {
+            matrix_idle = false;
         }
     }
+    return changed;
 }
+#endif
 
-void reset_state() {
-    _keyboard_state.modifiers = 0;
-    _keyboard_state.is_overflow = false;
-
-    for (uint8_t i = 0; i < (NUM_ROWS * NUM_COLS); i++) {
-        _keyboard_state.pressed_keys[i] = 0;
+bool matrix_scan() {
+    matrix_idle = true;
+    bool changed = scan_columns();
+#if EXPANDER_COLS
+    if (scan_expander()) {
+        changed = true;
     }
+#endif
+    return changed;
 }
+#endif  // MATRIX_ANALOG
 
-keyboard_state_t* get_pressed_keys() {
-    reset_state();
-
-    uint8_t k = 0;
-    uint8_t num_pressed_keys = 0;
-    for (uint8_t i = 0; i < NUM_COLS; i++) {
-        for (uint8_t j = 0; j < NUM_ROWS; j++) {
-            const uint8_t keycode = keyboard_layout[j][i];
-            const bool is_pressed = keyboard_state[j][i];
-            if (!is_pressed) {
-                if (is_modifier_key(keycode)) {
-                    _keyboard_state.modifiers &= ~(1 << (keycode & ~0xe0));
-                } else {
-                    _keyboard_state.pressed_keys[k] = 0;
-                }
-            } else {
-                if (is_modifier_key(keycode)) {
-                    _keyboard_state.modifiers |= (1 << (keycode & ~0xe0));
-                } else {
-                    num_pressed_keys++;
-                    _keyboard_state.pressed_keys[num_pressed_keys] =
-                        keyboard_layout[j][i];
-                }
-            }
-            k++;
+#if MATRIX_PCINT_WAKEUP
+static void drive_all_columns(bool high) {
+#if MATRIX_SHIFT_REGISTER
+    shift_columns(high ? SR_ALL_COLUMNS : NUM_LOCAL_COLS);
+    latch_columns();
+#else
+    for (uint8_t i = 0; i < NUM_LOCAL_COLS; i++) {
+        if (high) {
+            set_high(col_pins[i]);
+        } else {
+            set_low(col_pins[i]);
         }
     }
+#endif
+}
+
+bool matrix_arm_wakeup() {
+    uint8_t mask = 0;
+    for (uint8_t j = 0; j < NUM_ROWS; j++) {
+        mask |= (1 << row_pins[j]);  // PCINT0-7 are the pins of port B
+    }
 
-    if (num_pressed_keys > 6) {
-        _keyboard_state.is_overflow = true;
+    drive_all_columns(true);
+    _delay_us(MATRIX_SETTLE_US);
+
+    PCIFR = (1 << PCIF0);
+    PCMSK0 = mask;
+    PCICR |= (1 << PCIE0);
+
+    // A key pressed before the interrupt was enabled would never trigger it
+    if (read_rows()) {
+        matrix_disarm_wakeup();
+        return false;
     }
+    return true;
+}
 
-    return &_keyboard_state;
-}
\ No newline at end of file
+void matrix_disarm_wakeup() {
+    PCICR &= ~(1 << PCIE0);
+    PCMSK0 = 0;
+    drive_all_columns(false);
+}
+#endif
@@ -1,13 +1,81 @@
+#ifndef MATRIX_H
+#define MATRIX_H
 #include <avr/io.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <util/delay.h>
+
+#include "board.h"
 #include "keys.h"
 
-__attribute__((always_inline)) static inline bool is_modifier_key(
-    uint8_t keycode) {
-    return (keycode >= 0xe0) && (keycode <= 0xe7);
-}
+#define NUM_KEYS (NUM_ROWS * NUM_COLS)
+// Columns scanned directly by the MCU, the rest are behind the expander
+#define NUM_LOCAL_COLS (NUM_COLS - EXPANDER_COLS)
+
+#if NUM_ROWS > 16
+#error "At most 16 rows are supported"
+#endif
+
+// Bitmask of the rows of a single column, bit j is row j
+#if NUM_ROWS > 8
+typedef uint16_t matrix_rows_t;
+#else
+typedef uint8_t matrix_rows_t;
+#endif
+
+#define ROW_BIT(j) ((matrix_rows_t)1 << (j))
+
+// Port B pins of the columns and the rows. Constant, so that a lookup with a
+// constant index folds into the pin number and set_high()/set_low()/
+// read_pin() become single sbi/cbi/in instructions.
+static const uint8_t col_pins[NUM_LOCAL_COLS] = MATRIX_COL_PINS;
+static const uint8_t row_pins[NUM_ROWS] = MATRIX_ROW_PINS;
+
+// `make bench` builds the scan with MATRIX_UNROLL_SCAN=0, which runs the
+// statements in a plain loop, to measure what the unrolling saves
+#ifndef MATRIX_UNROLL_SCAN
+#define MATRIX_UNROLL_SCAN 1
+#endif
+
+#if MATRIX_UNROLL_SCAN
+// Expands the statements once for every i below n (at most 8, a port has no
+// more pins) with i a constant, the loop over the pins of a port unrolled
+// whatever the optimizer decides
+#define MATRIX_UNROLL(i, n, ...)           \
+    MATRIX_UNROLL_AT(0, i, n, __VA_ARGS__) \
+    MATRIX_UNROLL_AT(1, i, n, __VA_ARGS__) \
+    MATRIX_UNROLL_AT(2, i, n, __VA_ARGS__) \
+    MATRIX_UNROLL_AT(3, i, n, __VA_ARGS__) \
+    MATRIX_UNROLL_AT(4, i, n, __VA_ARGS__) \
+    MATRIX_UNROLL_AT(5, i, n, __VA_ARGS__) \
+    MATRIX_UNROLL_AT(6, i, n, __VA_ARGS__) \
+    MATRIX_UNROLL_AT(7, i, n, __VA_ARGS__)
+#define MATRIX_UNROLL_AT(k, i, n, ...) \
+    {                                  \
+        const uint8_t i = (k);         \
+        if (i < (n)) {                 \
+            __VA_ARGS__                \
+        }                              \
+    }
+#else
+#define MATRIX_UNROLL(i, n, ...)        \
+    for (uint8_t i = 0; i < (n); i++) { \
+        __VA_ARGS__                     \
+    }
+#endif
+
+// Debounced state of the matrix, one bitmask of rows per column
+extern matrix_rows_t matrix_state[NUM_COLS];
+// Set by matrix_scan() when no key was down and no debounce was in progress
+extern bool matrix_idle;
+
+void init_pins();
+bool matrix_scan();
+// Drives all columns and enables the pin change interrupt of the rows, so
+// that any key press triggers PCINT0_vect. Returns false (and stays disarmed)
+// if a key is already down.
+bool matrix_arm_wakeup();
+void matrix_disarm_wakeup();
 
 __attribute__((always_inline)) static inline void set_as_output(uint8_t pin) {
     DDRB |= (1 << pin);
@@ -28,4 +96,6 @@ __attribute__((always_inline)) static inline void set_low(uint8_t pin) {
 __attribute__((always_inline, warn_unused_result)) static inline bool read_pin(
     uint8_t pin) {
     return (PINB & (1 << pin)) ? true : false;
-}
\ No newline at end of file
+}
+
+#endif
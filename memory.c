@@ -0,0 +1,43 @@
+#include "memory.h"
+
+#include <avr/io.h>
+
+// The RAM between the end of the static data and the stack is painted with
+// this pattern right after reset. Everything the stack (interrupts included)
+// ever reached has been overwritten since, there is no heap to get in the
+// way.
+#define STACK_PAINT 0xC5
+
+extern uint8_t _end;     // End of .bss, from the linker script
+extern uint8_t __stack;  // Initial stack pointer (RAMEND)
+
+// Runs in .init3, after the stack pointer is set and before .data and .bss
+// are initialized, which the paint stays clear of
+__attribute__((naked, used, section(".init3"))) static void paint_stack() {
+    __asm__ __volatile__(
+        "    ldi r30, lo8(_end)\n\t"
+        "    ldi r31, hi8(_end)\n\t"
+        "    ldi r24, %[paint]\n\t"
+        "    ldi r25, hi8(__stack)\n\t"
+        "    rjmp 2f\n\t"
+        "1:  st  Z+, r24\n\t"
+        "2:  cpi r30, lo8(__stack)\n\t"
+        "    cpc r31, r25\n\t"
+        "    brlo 1b\n\t"
+        "    breq 1b\n\t"
+        :
+        : [paint] "M"(STACK_PAINT));
+}
+
+void memory_get_stats(memory_stats_t *stats) {
+    const uint8_t *p = &_end;
+    const uint8_t *sp = (const uint8_t *)SP;
+    while (p < sp && *p == STACK_PAINT) {
+        p++;
+    }
+
+    stats->static_size = &_end - (uint8_t *)RAMSTART;
+    stats->stack_peak = &__stack - p;
+    stats->stack_now = &__stack - sp;
+    stats->free_min = p - &_end;
+}
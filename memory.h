@@ -0,0 +1,16 @@
+#ifndef MEMORY_H
+#define MEMORY_H
+#include <stdint.h>
+
+// RAM usage, see memory.c. All sizes in bytes.
+typedef struct {
+    uint16_t static_size;  // .data and .bss
+    uint16_t stack_peak;   // Deepest the stack got since reset
+    uint16_t stack_now;    // Current depth of the stack
+    uint16_t free_min;     // Smallest gap there ever was between the static
+                           // data and the stack
+} memory_stats_t;
+
+void memory_get_stats(memory_stats_t *stats);
+
+#endif
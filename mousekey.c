@@ -0,0 +1,110 @@
+#include "mousekey.h"
+
+#include <avr/pgmspace.h>
+
+#include "board.h"
+
+mouse_report_t mouse_report;
+
+// Ease-in acceleration curve, 0-256 over 16 steps of MOUSEKEY_CURVE_STEP_MS
+static const uint8_t curve[17] PROGMEM = {
+    0,  1,  4,  9,  16,  25,  36,  49,  64,
+    81, 100, 121, 144, 169, 196, 225, 255};
+
+#define DIRECTION_MASK                                                \
+    ((1 << MS_UP) | (1 << MS_DOWN) | (1 << MS_LEFT) | (1 << MS_RIGHT) | \
+     (1 << MS_WH_UP) | (1 << MS_WH_DOWN))
+
+static uint8_t directions = 0;
+static uint8_t buttons = 0;
+static bool buttons_changed = false;
+// Frames since the motion started, saturates at the end of the curve
+static uint16_t motion_frames = 0;
+// Sub-pixel remainders of the motion, 8.8 fixed point
+static uint16_t remainder_x = 0;
+static uint16_t remainder_y = 0;
+static uint16_t remainder_wheel = 0;
+
+void mousekey_event(uint8_t code, bool pressed) {
+    if (code >= MS_BTN1) {
+        const uint8_t button = 1 << (code - MS_BTN1);
+        buttons = pressed ? (buttons | button) : (buttons & ~button);
+        buttons_changed = true;
+        return;
+    }
+
+    if (pressed) {
+        if (!(directions & DIRECTION_MASK)) {
+            motion_frames = 0;
+        }
+        directions |= (1 << code);
+    } else {
+        directions &= ~(1 << code);
+    }
+}
+
+// Speed in pixels (or wheel steps) per frame, 8.8 fixed point
+static uint16_t speed(uint16_t initial, uint16_t max) {
+    const uint8_t step = motion_frames / MOUSEKEY_CURVE_STEP_MS;
+    uint16_t position = (uint16_t)pgm_read_byte(&curve[step]) << 8;
+    if (step < 16) {
+        // Linear interpolation to the next point of the curve
+        const uint8_t next = pgm_read_byte(&curve[step + 1]);
+        const uint8_t fraction =
+            (motion_frames % MOUSEKEY_CURVE_STEP_MS) * 256 /
+            MOUSEKEY_CURVE_STEP_MS;
+        position += (next - pgm_read_byte(&curve[step])) * fraction;
+    }
+    // position is 0-65535, scale the speed range with it
+    return initial + (uint16_t)(((uint32_t)(max - initial) * position) >> 16);
+}
+
+static int8_t move(uint16_t *remainder, uint16_t speed, bool negative,
+                   bool positive) {
+    if (negative == positive) {
+        *remainder = 0;
+        return 0;
+    }
+    *remainder += speed;
+    const int8_t pixels = *remainder >> 8;
+    *remainder &= 0xFF;
+    return positive ? pixels : -pixels;
+}
+
+bool mousekey_frame() {
+    if (!(directions & DIRECTION_MASK)) {
+        mouse_report.x = 0;
+        mouse_report.y = 0;
+        mouse_report.wheel = 0;
+        mouse_report.buttons = buttons;
+        const bool send = buttons_changed;
+        buttons_changed = false;
+        return send;
+    }
+
+    if (motion_frames < 16 * MOUSEKEY_CURVE_STEP_MS) {
+        motion_frames++;
+    }
+
+    uint16_t pointer_speed =
+        speed(MOUSEKEY_INITIAL_SPEED, MOUSEKEY_MAX_SPEED);
+    const bool vertical = directions & ((1 << MS_UP) | (1 << MS_DOWN));
+    const bool horizontal = directions & ((1 << MS_LEFT) | (1 << MS_RIGHT));
+    if (vertical && horizontal) {
+        pointer_speed = ((uint32_t)pointer_speed * 181) >> 8;  // 1/sqrt(2)
+    }
+
+    mouse_report.buttons = buttons;
+    mouse_report.x = move(&remainder_x, pointer_speed,
+                          directions & (1 << MS_LEFT),
+                          directions & (1 << MS_RIGHT));
+    mouse_report.y = move(&remainder_y, pointer_speed,
+                          directions & (1 << MS_UP),
+                          directions & (1 << MS_DOWN));
+    mouse_report.wheel = move(
+        &remainder_wheel,
+        speed(MOUSEKEY_WHEEL_INITIAL_SPEED, MOUSEKEY_WHEEL_MAX_SPEED),
+        directions & (1 << MS_WH_DOWN), directions & (1 << MS_WH_UP));
+    buttons_changed = false;
+    return true;
+}
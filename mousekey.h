@@ -0,0 +1,32 @@
+#ifndef MOUSEKEY_H
+#define MOUSEKEY_H
+#include <stdbool.h>
+#include <stdint.h>
+
+// Mouse key codes, used as the keycode of KEYCLASS_MOUSE keymap entries.
+// Keep in sync with MOUSE_KEYS in keymapc.py.
+#define MS_UP 0
+#define MS_DOWN 1
+#define MS_LEFT 2
+#define MS_RIGHT 3
+#define MS_WH_UP 4
+#define MS_WH_DOWN 5
+#define MS_BTN1 6
+#define MS_BTN2 7
+#define MS_BTN3 8
+
+typedef struct {
+    uint8_t buttons;
+    int8_t x;
+    int8_t y;
+    int8_t wheel;
+} mouse_report_t;
+
+extern mouse_report_t mouse_report;
+
+void mousekey_event(uint8_t code, bool pressed);
+// Advances the motion by one frame (1ms) and updates mouse_report, returns
+// true if the report has to be sent
+bool mousekey_frame();
+
+#endif
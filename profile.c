@@ -0,0 +1,41 @@
+#include "profile.h"
+
+#include <stdbool.h>
+
+#if PROFILE
+profile_t profiles[NUM_PROFILE_POINTS];
+
+static volatile uint8_t reset_requested[NUM_PROFILE_POINTS];
+
+void profile_reset() {
+    for (uint8_t i = 0; i < NUM_PROFILE_POINTS; i++) {
+        reset_requested[i] = true;
+    }
+}
+
+void profile_record(uint8_t point, uint16_t cycles) {
+    profile_t *profile = &profiles[point];
+    if (reset_requested[point] || profile->count == 0) {
+        reset_requested[point] = false;
+        profile->min = cycles;
+        profile->max = cycles;
+        profile->total = cycles;
+        profile->count = 1;
+        return;
+    }
+
+    if (cycles < profile->min) {
+        profile->min = cycles;
+    }
+    if (cycles > profile->max) {
+        profile->max = cycles;
+    }
+    // Halving both keeps the mean when the total is about to overflow
+    if (profile->total > UINT32_MAX - cycles) {
+        profile->total >>= 1;
+        profile->count >>= 1;
+    }
+    profile->total += cycles;
+    profile->count++;
+}
+#endif
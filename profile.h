@@ -0,0 +1,51 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+#include <stdint.h>
+
+#include "timer.h"
+
+// Cycle profiler for the interrupts and the stages of the scan pipeline,
+// built with PROFILE=1 (the default, `make release` leaves it out). Times
+// are taken from the Timer1 cycle counter, so a single measurement must stay
+// below 65536 cycles (~4ms).
+
+enum PROFILE_POINT {
+    PROFILE_USB_GEN,      // ISR(USB_GEN_vect)
+    PROFILE_USB_COM,      // ISR(USB_COM_vect), includes control transfers
+    PROFILE_MATRIX_SCAN,  // matrix_scan()
+    PROFILE_DEBOUNCE,     // Debounce of a single column
+    PROFILE_REPORT,       // Combos and report building
+    PROFILE_RGB_RENDER,   // Rendering a frame of the RGB effect
+    PROFILE_RGB_OUTPUT,   // Sending the RGB framebuffer to the LEDs
+    NUM_PROFILE_POINTS,
+};
+
+typedef struct {
+    uint16_t min;
+    uint16_t max;
+    uint32_t total;  // The mean is total / count, computed by the host
+    uint32_t count;
+} profile_t;
+
+#ifndef PROFILE
+#define PROFILE 0
+#endif
+
+#if PROFILE
+extern profile_t profiles[NUM_PROFILE_POINTS];
+
+void profile_record(uint8_t point, uint16_t cycles);
+// Safe to call from an interrupt, every point clears itself on its next
+// measurement so a reset never races with an update
+void profile_reset();
+
+#define PROFILE_START(point) \
+    const uint16_t profile_start_##point = timer_cycles()
+#define PROFILE_END(point) \
+    profile_record(point, timer_cycles() - profile_start_##point)
+#else
+#define PROFILE_START(point)
+#define PROFILE_END(point)
+#endif
+
+#endif
@@ -0,0 +1,350 @@
+#include "ps2.h"
+
+#include <avr/interrupt.h>
+#include <avr/io.h>
+
+#include "timer.h"
+
+#if PS2_MOUSE
+
+#if RGB_LEDS
+#error "The WS2812 refresh blocks the interrupts for longer than a PS/2 bit"
+#endif
+
+// Device commands and replies
+#define PS2_RESET 0xFF
+#define PS2_ENABLE_REPORTING 0xF4
+#define PS2_ACK 0xFA
+#define PS2_SELF_TEST_PASSED 0xAA
+
+// How long to wait for the device before resetting it again
+#define PS2_TIMEOUT_MS 1000
+// The host has to hold the clock low for at least 100us to send
+#define PS2_INHIBIT_CYCLES (100 * CYCLES_PER_US)
+// The device clocks at 10-16.7khz, a longer pause within a frame means an
+// edge was missed
+#define PS2_BIT_TIMEOUT_CYCLES (250 * CYCLES_PER_US)
+
+// First byte of a movement packet
+#define PACKET_BUTTONS 0x07
+#define PACKET_ALWAYS_SET (1 << 3)
+#define PACKET_X_SIGN (1 << 4)
+#define PACKET_Y_SIGN (1 << 5)
+#define PACKET_OVERFLOW ((1 << 6) | (1 << 7))
+
+// Most motion kept for the host, 8 full reports
+#define MOTION_LIMIT (8 * 127)
+
+enum PS2_STATE {
+    STATE_RESET,
+    STATE_SELF_TEST,  // Waiting for the device to come out of reset
+    STATE_ENABLE,     // Waiting for the ack of PS2_ENABLE_REPORTING
+    STATE_STREAM,
+};
+
+// Direction of the current frame on the wire
+enum PS2_LINE {
+    LINE_RECEIVE,
+    LINE_INHIBIT,  // Clock held low, about to send
+    LINE_SEND,
+};
+
+static uint8_t state = STATE_RESET;
+static uint32_t state_since;
+
+static volatile uint8_t line = LINE_RECEIVE;
+static uint16_t inhibit_start;
+static uint8_t send_byte;
+
+// Frame being received or sent, owned by the interrupt
+static uint8_t bit_index = 0;
+static uint8_t frame = 0;
+static uint8_t ones = 0;
+// Time of the last clock edge. Timer1 wraps every ~4ms, so pauses longer
+// than that are told apart by the ms clock.
+static uint16_t last_edge_cycles;
+static uint8_t last_edge_ms;
+
+// Replies seen while not streaming
+#define SEEN_ACK (1 << 0)
+#define SEEN_SELF_TEST (1 << 1)
+#define SEEN_ID (1 << 2)  // The device ID, which follows the self test, also
+                          // set when the device resets while streaming
+static volatile uint8_t seen = 0;
+
+// Movement not sent to the host yet, only touched by interrupts
+static uint8_t packet[3];
+static uint8_t packet_index = 0;
+static int16_t motion_x = 0;
+static int16_t motion_y = 0;
+static uint8_t buttons = 0;
+static uint8_t sent_buttons = 0;
+
+// Both lines are open collector: PORT stays low, so an output drives the line
+// low and an input lets the pull-up take it high
+
+__attribute__((always_inline)) static inline void clock_low() {
+    DDRE |= (1 << PORTE6);
+}
+
+__attribute__((always_inline)) static inline void clock_release() {
+    DDRE &= ~(1 << PORTE6);
+}
+
+__attribute__((always_inline)) static inline void data_low() {
+    DDRD |= (1 << PS2_DATA_PIN);
+}
+
+__attribute__((always_inline)) static inline void data_release() {
+    DDRD &= ~(1 << PS2_DATA_PIN);
+}
+
+void ps2_init() {
+    PORTE &= ~(1 << PORTE6);
+    PORTD &= ~(1 << PS2_DATA_PIN);
+    clock_release();
+    data_release();
+
+    // Interrupt on the falling edge
+    EICRB = (EICRB & ~((1 << ISC61) | (1 << ISC60))) | (1 << ISC61);
+    EIFR = (1 << INTF6);
+    EIMSK |= (1 << INT6);
+}
+
+static void send(uint8_t byte) {
+    EIMSK &= ~(1 << INT6);
+    send_byte = byte;
+    clock_low();
+    inhibit_start = timer_cycles();
+    line = LINE_INHIBIT;
+}
+
+// Second half of send(), once the clock has been held low long enough: the
+// start bit goes on the data line and the device starts clocking
+static void start_sending() {
+    bit_index = 0;
+    ones = 0;
+    data_low();
+    line = LINE_SEND;
+    EIFR = (1 << INTF6);
+    EIMSK |= (1 << INT6);
+    clock_release();
+}
+
+static void set_state(uint8_t next) {
+    state = next;
+    state_since = timer_millis();
+    seen = 0;
+}
+
+void ps2_task() {
+    if (line == LINE_INHIBIT) {
+        if ((uint16_t)(timer_cycles() - inhibit_start) >= PS2_INHIBIT_CYCLES) {
+            start_sending();
+        }
+        return;
+    }
+
+    const uint32_t now = timer_millis();
+    switch (state) {
+        case STATE_RESET:
+            set_state(STATE_SELF_TEST);
+            send(PS2_RESET);
+            break;
+        case STATE_SELF_TEST:
+            // Sending cuts off anything the device is still sending, so wait
+            // for the whole reply to the reset
+            if (seen & SEEN_ID) {
+                set_state(STATE_ENABLE);
+                send(PS2_ENABLE_REPORTING);
+            } else if (now - state_since >= PS2_TIMEOUT_MS) {
+                set_state(STATE_RESET);
+            }
+            break;
+        case STATE_ENABLE:
+            if (seen & SEEN_ACK) {
+                packet_index = 0;
+                set_state(STATE_STREAM);
+            } else if (now - state_since >= PS2_TIMEOUT_MS) {
+                set_state(STATE_RESET);
+            }
+            break;
+        case STATE_STREAM:
+            if (seen & SEEN_ID) {
+                set_state(STATE_ENABLE);
+                send(PS2_ENABLE_REPORTING);
+            }
+            break;
+    }
+}
+
+// Adds to the motion waiting for the host, which stops taking it while the
+// bus is suspended or not configured yet. Capped, so that nothing overflows
+// and the cursor does not leap across the screen on resume.
+static void accumulate(int16_t *motion, int16_t delta) {
+    const int16_t value = *motion + delta;
+    *motion = value < -MOTION_LIMIT  ? -MOTION_LIMIT
+              : value > MOTION_LIMIT ? MOTION_LIMIT
+                                     : value;
+}
+
+static void receive_packet() {
+    const uint8_t flags = packet[0];
+    buttons = flags & PACKET_BUTTONS;
+    if (flags & PACKET_OVERFLOW) {
+        return;
+    }
+    // 9 bit two's complement, y grows upwards unlike in the HID report
+    accumulate(&motion_x,
+               (flags & PACKET_X_SIGN) ? (int16_t)packet[1] - 256 : packet[1]);
+    accumulate(&motion_y,
+               (flags & PACKET_Y_SIGN) ? 256 - (int16_t)packet[2] : -packet[2]);
+}
+
+static void receive(uint8_t byte) {
+    if (state != STATE_STREAM) {
+        if (seen & SEEN_SELF_TEST) {
+            seen |= SEEN_ID;
+        } else if (byte == PS2_SELF_TEST_PASSED) {
+            seen |= SEEN_SELF_TEST;
+        } else if (byte == PS2_ACK) {
+            seen |= SEEN_ACK;
+        }
+        return;
+    }
+
+    // Bit 3 of the first byte is always set, which is all there is to find
+    // the start of a packet after losing a byte
+    if (packet_index == 0 && !(byte & PACKET_ALWAYS_SET)) {
+        return;
+    }
+    packet[packet_index++] = byte;
+    // A device which reset itself (re-plugged, power glitch) says so with
+    // the self test reply and its ID, and does not report until it is
+    // enabled again. As a packet this would have the Y overflow bit (bit 7)
+    // set, which is dropped anyway.
+    if (packet_index == 2 && packet[0] == PS2_SELF_TEST_PASSED && byte == 0) {
+        packet_index = 0;
+        seen |= SEEN_ID;
+        return;
+    }
+    if (packet_index == sizeof(packet)) {
+        packet_index = 0;
+        receive_packet();
+    }
+}
+
+// Falling clock edge. Device to host frames are a start bit, 8 data bits
+// (LSB first), odd parity and a stop bit, all read while the clock is low.
+// Host to device frames are clocked by the device too, the host changes the
+// data line while the clock is low and the device acks with the 11th edge.
+ISR(INT6_vect) {
+    // The data bit is only valid while the clock is low, it is sampled before
+    // anything else, which may still run on the slow clock
+    const bool data = PIND & (1 << PS2_DATA_PIN);
+#if CLOCK_SCALING
+    timer_clock_full();
+#endif
+
+    if (line == LINE_SEND) {
+        if (bit_index < 8) {
+            if (send_byte & (1 << bit_index)) {
+                data_release();
+                ones++;
+            } else {
+                data_low();
+            }
+        } else if (bit_index == 8) {
+            if (ones & 1) {
+                data_low();
+            } else {
+                data_release();
+            }
+        } else if (bit_index == 9) {
+            data_release();  // Stop bit
+        } else {
+            // The ack, a missing one shows up as the state timing out
+            line = LINE_RECEIVE;
+            bit_index = 0;
+            last_edge_cycles = timer_cycles();
+            last_edge_ms = timer_millis();
+            return;
+        }
+        bit_index++;
+        return;
+    }
+
+    // Bits of a frame are 60-100us apart, a longer pause within a frame
+    // means a bit was missed, start over with the next frame. Bytes of a
+    // packet may be further apart, only a pause of milliseconds starts a new
+    // packet.
+    const uint16_t cycles = timer_cycles();
+    const uint8_t now = timer_millis();
+    const bool long_pause = (uint8_t)(now - last_edge_ms) > 1;
+    if (long_pause ||
+        (bit_index != 0 &&
+         (uint16_t)(cycles - last_edge_cycles) > PS2_BIT_TIMEOUT_CYCLES)) {
+        bit_index = 0;
+        packet_index = 0;
+    }
+    last_edge_cycles = cycles;
+    last_edge_ms = now;
+
+    if (bit_index == 0) {
+        if (!data) {  // Start bit
+            frame = 0;
+            ones = 0;
+            bit_index = 1;
+        }
+        return;
+    }
+    if (bit_index <= 8) {
+        if (data) {
+            frame |= (1 << (bit_index - 1));
+            ones++;
+        }
+    } else if (bit_index == 9) {
+        if (data) {
+            ones++;
+        }
+    } else {
+        bit_index = 0;
+        if (data && (ones & 1)) {  // Stop bit and odd parity
+            receive(frame);
+        } else {
+            packet_index = 0;
+        }
+        return;
+    }
+    bit_index++;
+}
+
+__attribute__((always_inline)) static inline int8_t clamp(int16_t value) {
+    return value < -127 ? -127 : value > 127 ? 127 : value;
+}
+
+// Takes as much of the motion as fits into a report
+static int8_t take(int16_t *motion) {
+    const int8_t value = clamp(*motion);
+    *motion -= value;
+    return value;
+}
+
+bool ps2_mouse_frame(mouse_report_t *report) {
+    // The SOF and the clock interrupt never nest, so the accumulators can be
+    // used directly
+    const int8_t x = take(&motion_x);
+    const int8_t y = take(&motion_y);
+    report->x = clamp(report->x + x);  // Mouse keys may be moving too
+    report->y = clamp(report->y + y);
+    report->buttons |= buttons;
+
+    const bool changed = x != 0 || y != 0 || buttons != sent_buttons;
+    sent_buttons = buttons;
+    return changed;
+}
+
+#else
+void ps2_init() {}
+void ps2_task() {}
+#endif  // PS2_MOUSE
@@ -0,0 +1,22 @@
+#ifndef PS2_H
+#define PS2_H
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "board.h"
+#include "mousekey.h"
+
+// PS/2 mouse (TrackPoint) host (PS2_MOUSE). The clock is on INT6 (PE6), the
+// data on PS2_DATA_PIN of port D, both need external pull-ups. Every bit is
+// handled by the falling clock edge interrupt, which decodes the movement
+// packets into an accumulator, nothing ever waits for the device. ps2_task()
+// resets the device and enables streaming, and retries every second until a
+// device answers. A device which resets itself later is enabled again.
+
+void ps2_init();
+void ps2_task();
+// Adds the movement and buttons received since the last frame to the report,
+// returns true if it has to be sent. Called from the SOF interrupt.
+bool ps2_mouse_frame(mouse_report_t *report);
+
+#endif
@@ -0,0 +1,145 @@
+#include "report.h"
+
+#include "console.h"
+#include "keymap.h"
+#include "keys.h"
+#include "mousekey.h"
+
+keyboard_report_t report_snapshots[2];
+volatile uint8_t report_current = 0;
+volatile uint8_t report_seq = 0;
+
+// The report being edited, and whether it differs from the current snapshot
+static keyboard_report_t keyboard_report;
+static bool report_dirty = false;
+
+// State of the keys as of the last update
+static matrix_rows_t reported[NUM_COLS];
+
+// Keycodes occupying the report slots and the number of keys holding each of
+// them, a keycode keeps its slot for as long as it is held
+static uint8_t slots[REPORT_KEYS];
+static uint8_t holders[REPORT_KEYS];
+// Keys which did not fit in the report, they take over slots as they free up
+static uint8_t overflow[REPORT_KEYS];
+static uint8_t num_overflow = 0;
+// Number of keys holding each modifier bit, the bit is cleared once the last
+// of them is released
+static uint8_t modifier_holders[8];
+
+static void publish_keys() {
+    for (uint8_t i = 0; i < REPORT_KEYS; i++) {
+        keyboard_report.keys[i] = num_overflow > 0 ? KEY_ERR_OVF : slots[i];
+    }
+    report_dirty = true;
+}
+
+static void publish_report() {
+    const uint8_t next = report_current ^ 1;
+    report_snapshots[next] = keyboard_report;
+    // The copy has to be complete before the interrupts can see it
+    __asm__ __volatile__("" ::: "memory");
+    report_current = next;
+    report_seq++;
+    report_dirty = false;
+}
+
+void report_add_keycode(uint8_t keycode) {
+    int8_t free_slot = -1;
+    for (uint8_t i = 0; i < REPORT_KEYS; i++) {
+        if (slots[i] == keycode) {
+            holders[i]++;
+            return;
+        }
+        if (slots[i] == KEY_NONE && free_slot < 0) {
+            free_slot = i;
+        }
+    }
+
+    if (free_slot >= 0) {
+        slots[free_slot] = keycode;
+        holders[free_slot] = 1;
+    } else if (num_overflow < REPORT_KEYS) {
+        overflow[num_overflow++] = keycode;
+    }
+    publish_keys();
+}
+
+void report_remove_keycode(uint8_t keycode) {
+    for (uint8_t i = 0; i < num_overflow; i++) {
+        if (overflow[i] == keycode) {
+            overflow[i] = overflow[--num_overflow];
+            publish_keys();
+            return;
+        }
+    }
+
+    for (uint8_t i = 0; i < REPORT_KEYS; i++) {
+        if (slots[i] != keycode) {
+            continue;
+        }
+        if (--holders[i] > 0) {
+            return;
+        }
+        slots[i] = KEY_NONE;
+        if (num_overflow > 0) {
+            slots[i] = overflow[--num_overflow];
+            holders[i] = 1;
+        }
+        publish_keys();
+        return;
+    }
+}
+
+static void key_event(uint16_t key, bool pressed) {
+    console_log(pressed ? CONSOLE_KEY_DOWN : CONSOLE_KEY_UP, 0, key);
+    if (keymap_class(key) == KEYCLASS_MOUSE) {
+        mousekey_event(keymap_keycode(key), pressed);
+        return;
+    }
+
+    const uint8_t modifiers = keymap_modifiers(key);
+    if (modifiers) {
+        for (uint8_t b = 0; b < 8; b++) {
+            if (!(modifiers & (1 << b))) {
+                continue;
+            }
+            if (pressed) {
+                modifier_holders[b]++;
+                keyboard_report.modifiers |= (1 << b);
+            } else if (modifier_holders[b] > 0 && --modifier_holders[b] == 0) {
+                keyboard_report.modifiers &= ~(1 << b);
+            }
+        }
+        report_dirty = true;
+    }
+
+    const uint8_t keycode = keymap_keycode(key);
+    if (keycode) {
+        if (pressed) {
+            report_add_keycode(keycode);
+        } else {
+            report_remove_keycode(keycode);
+        }
+    }
+}
+
+void report_update(const matrix_rows_t *keys) {
+    for (uint8_t i = 0; i < NUM_COLS; i++) {
+        const matrix_rows_t changed = keys[i] ^ reported[i];
+        if (!changed) {
+            continue;
+        }
+        reported[i] = keys[i];
+
+        for (uint8_t j = 0; j < NUM_ROWS; j++) {
+            if (changed & ROW_BIT(j)) {
+                key_event(i * NUM_ROWS + j, keys[i] & ROW_BIT(j));
+            }
+        }
+    }
+
+    if (report_dirty) {
+        publish_report();
+    }
+}
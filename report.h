@@ -0,0 +1,41 @@
+#ifndef REPORT_H
+#define REPORT_H
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "matrix.h"
+
+#define REPORT_KEYS 6
+
+// Boot protocol keyboard report
+typedef struct {
+    uint8_t modifiers;
+    uint8_t reserved;
+    uint8_t keys[REPORT_KEYS];
+} keyboard_report_t;
+
+// The main loop edits a private working report and publishes it by copying
+// it into the snapshot the USB interrupts are not using and then switching
+// report_current over to it, a single byte write. The interrupts only read
+// the current snapshot, and the main loop cannot run while they do, so they
+// always see a complete report without interrupts ever being disabled.
+extern keyboard_report_t report_snapshots[2];
+extern volatile uint8_t report_current;
+// Incremented with every published change, the interrupt endpoint compares
+// it with the sequence number of the last report it sent
+extern volatile uint8_t report_seq;
+
+__attribute__((always_inline)) static inline const keyboard_report_t *
+report_snapshot() {
+    return &report_snapshots[report_current];
+}
+
+// Applies the key presses and releases between the last and the current
+// state, `keys` is NUM_COLS long, and publishes the report if it changed
+void report_update(const matrix_rows_t *keys);
+// Edit the working report, the change is published by the next
+// report_update()
+void report_add_keycode(uint8_t keycode);
+void report_remove_keycode(uint8_t keycode);
+
+#endif
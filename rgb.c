@@ -0,0 +1,202 @@
+#include "rgb.h"
+
+#include <avr/io.h>
+#include <avr/pgmspace.h>
+#include <util/atomic.h>
+
+#include "matrix.h"
+#include "profile.h"
+#include "timer.h"
+
+#if RGB_LEDS
+
+#if F_CPU != 16000000UL
+#error "The WS2812 bit timing is counted in cycles at 16mhz"
+#endif
+// 24 bits of 1.25us per LED, sent with the interrupts disabled
+#define RGB_OUTPUT_US (NUM_KEYS * 30)
+#if RGB_OUTPUT_US > RGB_FRAME_BUDGET_US
+#error "Refreshing this many LEDs takes longer than RGB_FRAME_BUDGET_US"
+#endif
+
+// One full period of (1 - cos) / 2, the brightness of RGB_EFFECT_BREATHE
+static const uint8_t breathe_table[64] PROGMEM = {
+    0,   1,   2,   5,   10,  15,  21,  29,  37,  47,  57,  67,  79,
+    90,  103, 115, 127, 140, 152, 165, 176, 188, 198, 208, 218, 226,
+    234, 240, 245, 250, 253, 254, 255, 254, 253, 250, 245, 240, 234,
+    226, 218, 208, 198, 188, 176, 165, 152, 140, 128, 115, 103, 90,
+    79,  67,  57,  47,  37,  29,  21,  15,  10,  5,   2,   1};
+
+// Perceived to physical brightness (gamma 2.2), indexed by the top 6 bits
+static const uint8_t gamma_table[64] PROGMEM = {
+    0,   0,   0,   1,   1,   1,   2,   2,   3,   4,   5,   6,   7,
+    9,   10,  12,  13,  15,  17,  19,  22,  24,  26,  29,  32,  35,
+    38,  41,  44,  48,  51,  55,  59,  63,  67,  71,  76,  81,  85,
+    90,  95,  100, 106, 111, 117, 123, 129, 135, 141, 148, 154, 161,
+    168, 175, 182, 190, 197, 205, 213, 221, 229, 238, 246, 255};
+
+static rgb_color_t framebuffer[NUM_KEYS];
+static bool framebuffer_dirty = true;
+
+#if RGB_EFFECT == RGB_EFFECT_REACTIVE
+// Brightness of every key, set on a press and decaying every frame
+static uint8_t heat[NUM_KEYS];
+#endif
+
+// a * b / 256 with 255 * 255 = 255
+__attribute__((always_inline)) static inline uint8_t scale8(uint8_t a,
+                                                            uint8_t b) {
+    return ((uint16_t)a * (b + 1)) >> 8;
+}
+
+// 8 bit hue, saturation and value, gamma corrected
+static rgb_color_t hsv_to_rgb(uint8_t h, uint8_t s, uint8_t v) {
+    // Six sectors of 43 hue steps, the two rising and falling channels
+    // interpolated within the sector
+    const uint8_t sector = h / 43;
+    const uint8_t fraction = (h - sector * 43) * 6;
+    const uint8_t p = scale8(v, 255 - s);
+    const uint8_t q = scale8(v, 255 - scale8(s, fraction));
+    const uint8_t t = scale8(v, 255 - scale8(s, 255 - fraction));
+
+    uint8_t r, g, b;
+    switch (sector) {
+        case 0:
+            r = v, g = t, b = p;
+            break;
+        case 1:
+            r = q, g = v, b = p;
+            break;
+        case 2:
+            r = p, g = v, b = t;
+            break;
+        case 3:
+            r = p, g = q, b = v;
+            break;
+        case 4:
+            r = t, g = p, b = v;
+            break;
+        default:
+            r = v, g = p, b = q;
+            break;
+    }
+    return (rgb_color_t){.g = pgm_read_byte(&gamma_table[g >> 2]),
+                         .r = pgm_read_byte(&gamma_table[r >> 2]),
+                         .b = pgm_read_byte(&gamma_table[b >> 2])};
+}
+
+static void set_pixel(uint8_t k, rgb_color_t color) {
+    rgb_color_t *pixel = &framebuffer[k];
+    if (pixel->g != color.g || pixel->r != color.r || pixel->b != color.b) {
+        *pixel = color;
+        framebuffer_dirty = true;
+    }
+}
+
+// Sends the framebuffer to the chain. A bit takes 20 cycles (1.25us), high
+// for 6 (375ns) for a 0 and for 12 (750ns) for a 1. Loading the next byte
+// only stretches the low time, which the LEDs tolerate.
+static void ws2812_send() {
+    const uint8_t *data = (const uint8_t *)framebuffer;
+    uint16_t count = sizeof(framebuffer);
+    uint8_t byte, bits;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        __asm__ __volatile__(
+            "0:  ld   %[byte], %a[data]+\n\t"
+            "    ldi  %[bits], 8\n\t"
+            "1:  sbi  %[port], %[pin]\n\t"  // 0-1
+            "    lsl  %[byte]\n\t"          // 2
+            "    brcs 2f\n\t"               // 3, 3-4 when taken
+            "    nop\n\t"                   // 4
+            "    nop\n\t"                   // 5
+            "    cbi  %[port], %[pin]\n\t"  // 6-7, a 0 is high for 6
+            "    rjmp .+0\n\t"              // 8-9
+            "    rjmp .+0\n\t"              // 10-11
+            "    nop\n\t"                   // 12
+            "    rjmp 3f\n\t"               // 13-14
+            "2:  rjmp .+0\n\t"              // 5-6
+            "    rjmp .+0\n\t"              // 7-8
+            "    rjmp .+0\n\t"              // 9-10
+            "    nop\n\t"                   // 11
+            "    cbi  %[port], %[pin]\n\t"  // 12-13, a 1 is high for 12
+            "    nop\n\t"                   // 14
+            "3:  rjmp .+0\n\t"              // 15-16
+            "    dec  %[bits]\n\t"          // 17
+            "    brne 1b\n\t"               // 18-19
+            "    sbiw %[count], 1\n\t"
+            "    brne 0b\n\t"
+            : [byte] "=&r"(byte), [bits] "=&d"(bits), [data] "+e"(data),
+              [count] "+w"(count)
+            : [port] "I"(_SFR_IO_ADDR(PORTD)), [pin] "I"(RGB_PIN));
+    }
+}
+
+static void render(uint16_t now) {
+#if RGB_EFFECT == RGB_EFFECT_SOLID
+    const rgb_color_t color =
+        hsv_to_rgb(RGB_HUE, RGB_SATURATION, RGB_BRIGHTNESS);
+    for (uint8_t k = 0; k < NUM_KEYS; k++) {
+        set_pixel(k, color);
+    }
+#elif RGB_EFFECT == RGB_EFFECT_BREATHE
+    // A breath every 64 * 2^RGB_SPEED_SHIFT ms
+    const uint8_t level =
+        pgm_read_byte(&breathe_table[(now >> RGB_SPEED_SHIFT) & 63]);
+    const rgb_color_t color =
+        hsv_to_rgb(RGB_HUE, RGB_SATURATION, scale8(RGB_BRIGHTNESS, level));
+    for (uint8_t k = 0; k < NUM_KEYS; k++) {
+        set_pixel(k, color);
+    }
+#elif RGB_EFFECT == RGB_EFFECT_RAINBOW
+    // The wave goes through all hues every 256 * 2^RGB_SPEED_SHIFT ms and
+    // spans the whole board
+    const uint8_t base = now >> RGB_SPEED_SHIFT;
+    uint8_t k = 0;
+    for (uint8_t i = 0; i < NUM_COLS; i++) {
+        const rgb_color_t color = hsv_to_rgb(base + i * (256 / NUM_COLS),
+                                             RGB_SATURATION, RGB_BRIGHTNESS);
+        for (uint8_t j = 0; j < NUM_ROWS; j++, k++) {
+            set_pixel(k, color);
+        }
+    }
+#elif RGB_EFFECT == RGB_EFFECT_REACTIVE
+    uint8_t k = 0;
+    for (uint8_t i = 0; i < NUM_COLS; i++) {
+        for (uint8_t j = 0; j < NUM_ROWS; j++, k++) {
+            if (matrix_state[i] & ROW_BIT(j)) {
+                heat[k] = 255;
+            } else if (heat[k] > 0) {
+                // Fades out in 256 / RGB_FADE_STEP frames
+                heat[k] = heat[k] > RGB_FADE_STEP ? heat[k] - RGB_FADE_STEP : 0;
+            }
+            set_pixel(k, hsv_to_rgb(RGB_HUE, RGB_SATURATION,
+                                    scale8(RGB_BRIGHTNESS, heat[k])));
+        }
+    }
+#else
+#error "Unknown RGB_EFFECT"
+#endif
+}
+
+void rgb_init() {
+    DDRD |= (1 << RGB_PIN);
+    PORTD &= ~(1 << RGB_PIN);
+}
+
+void rgb_task() {
+    PROFILE_START(PROFILE_RGB_RENDER);
+    render(timer_millis());
+    PROFILE_END(PROFILE_RGB_RENDER);
+
+    if (framebuffer_dirty) {
+        framebuffer_dirty = false;
+        PROFILE_START(PROFILE_RGB_OUTPUT);
+        ws2812_send();
+        PROFILE_END(PROFILE_RGB_OUTPUT);
+    }
+}
+
+#else
+void rgb_init() {}
+void rgb_task() {}
+#endif  // RGB_LEDS
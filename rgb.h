@@ -0,0 +1,30 @@
+#ifndef RGB_H
+#define RGB_H
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "board.h"
+
+// Per-key RGB lighting on a chain of WS2812 LEDs (RGB_LEDS). LED k sits under
+// key k (col * NUM_ROWS + row), so the chain has to follow the key order.
+// The effect renders into a framebuffer every RGB_FRAME_MS, which is only
+// sent to the LEDs when a pixel actually changed.
+
+// RGB_EFFECT of board.h, the effect is picked at compile time
+#define RGB_EFFECT_SOLID 0     // RGB_HUE everywhere
+#define RGB_EFFECT_BREATHE 1   // RGB_HUE fading in and out
+#define RGB_EFFECT_RAINBOW 2   // Hue wave moving across the columns
+#define RGB_EFFECT_REACTIVE 3  // Pressed keys light up and fade out
+
+// In the order the WS2812 expects them on the wire
+typedef struct {
+    uint8_t g;
+    uint8_t r;
+    uint8_t b;
+} rgb_color_t;
+
+void rgb_init();
+// Renders the next frame of the effect and refreshes the LEDs if it changed
+void rgb_task();
+
+#endif
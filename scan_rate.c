@@ -0,0 +1,89 @@
+#include "scan_rate.h"
+
+#include <avr/interrupt.h>
+#include <avr/pgmspace.h>
+
+#include "board.h"
+#include "console.h"
+#include "matrix.h"
+#include "sched.h"
+#include "timer.h"
+
+static const scan_rate_t scan_rates[] PROGMEM = SCAN_RATES;
+_Static_assert(NUM_SCAN_RATES > 1, "SCAN_RATES needs at least one idle step");
+_Static_assert(NUM_SCAN_RATES - 1 == sizeof(scan_rates) / sizeof(scan_rates[0]),
+               "NUM_SCAN_RATES does not match SCAN_RATES");
+
+uint32_t scan_rate_residency[NUM_SCAN_RATES + 1];
+
+static uint8_t rate = 0;
+static uint32_t idle_since = 0;
+static uint32_t last_update = 0;
+
+void scan_rate_get_periods(uint8_t *periods) {
+    periods[0] = 0;
+    for (uint8_t i = 0; i < NUM_SCAN_RATES - 1; i++) {
+        periods[i + 1] = pgm_read_byte(&scan_rates[i].period_ms);
+    }
+}
+
+void scan_rate_update(bool idle) {
+    const uint32_t now = timer_millis();
+    scan_rate_residency[rate] += now - last_update;
+    last_update = now;
+
+    // First scan after a pin change, start over from the full rate
+    if (rate == SCAN_RATE_WAKEUP) {
+        idle = false;
+    }
+
+    if (!idle) {
+        idle_since = now;
+        if (rate != 0) {
+            rate = 0;
+            task_periods[TASK_SCAN] = 0;
+            task_periods[TASK_REPORT] = 0;
+            console_log(CONSOLE_SCAN_RATE, rate, 0);
+        }
+        return;
+    }
+
+#if MATRIX_PCINT_WAKEUP
+    if (now - idle_since >= SCAN_WAKEUP_IDLE_MS) {
+        // Nothing left to do until a key goes down, the scheduler sleeps
+        // through everything but the ms tick. The tasks are suspended before
+        // arming, a press right after arming then resumes them instead of
+        // being lost.
+        sched_suspend(TASK_SCAN);
+        sched_suspend(TASK_REPORT);
+        if (matrix_arm_wakeup()) {
+            rate = SCAN_RATE_WAKEUP;
+            console_log(CONSOLE_SCAN_RATE, rate, 0);
+            return;
+        }
+        sched_resume(TASK_SCAN);
+        sched_resume(TASK_REPORT);
+    }
+#endif
+
+    if (rate < NUM_SCAN_RATES - 1 &&
+        now - idle_since >= pgm_read_word(&scan_rates[rate].idle_ms)) {
+        // The report only changes after a scan, so it follows the scan rate
+        const uint8_t period = pgm_read_byte(&scan_rates[rate].period_ms);
+        task_periods[TASK_SCAN] = period;
+        task_periods[TASK_REPORT] = period;
+        rate++;
+        console_log(CONSOLE_SCAN_RATE, rate, 0);
+    }
+}
+
+#if MATRIX_PCINT_WAKEUP
+// A row changed while all columns are driven, a key went down. Scanning
+// resumes on the next pass of the scheduler, so the press is seen after at
+// most one scan more than when scanning at full rate.
+ISR(PCINT0_vect) {
+    matrix_disarm_wakeup();
+    sched_resume(TASK_SCAN);
+    sched_resume(TASK_REPORT);
+}
+#endif
@@ -0,0 +1,31 @@
+#ifndef SCAN_RATE_H
+#define SCAN_RATE_H
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "board.h"
+
+typedef struct {
+    uint16_t idle_ms;
+    uint8_t period_ms;
+} scan_rate_t;
+
+// Full rate plus the idle steps of SCAN_RATES
+#define NUM_SCAN_RATES \
+    (sizeof((scan_rate_t[])SCAN_RATES) / sizeof(scan_rate_t) + 1)
+// Scanning stopped, waiting for the pin change interrupt of a row
+#define SCAN_RATE_WAKEUP NUM_SCAN_RATES
+
+// Time spent at each scan rate in ms, index 0 is the full rate and the last
+// one the time spent waiting for a pin change
+extern uint32_t scan_rate_residency[NUM_SCAN_RATES + 1];
+
+// Writes the scan period in ms of each rate, 0 for the full rate
+void scan_rate_get_periods(uint8_t *periods);
+
+// Called after every scan, steps the scan period of the scheduler up while
+// the matrix stays idle and back to full rate on activity. With
+// MATRIX_PCINT_WAKEUP the scan stops altogether after SCAN_WAKEUP_IDLE_MS.
+void scan_rate_update(bool idle);
+
+#endif
@@ -0,0 +1,180 @@
+#include "sched.h"
+
+#include <avr/interrupt.h>
+#include <avr/pgmspace.h>
+#include <avr/sleep.h>
+#include <stdbool.h>
+
+#include "combo.h"
+#include "key_stats.h"
+#include "leds.h"
+#include "matrix.h"
+#include "profile.h"
+#include "ps2.h"
+#include "report.h"
+#include "rgb.h"
+#include "scan_rate.h"
+#include "timer.h"
+
+static void scan_task() {
+    PROFILE_START(PROFILE_MATRIX_SCAN);
+    matrix_scan();
+    PROFILE_END(PROFILE_MATRIX_SCAN);
+    scan_rate_update(matrix_idle);
+}
+
+static void report_task() {
+    PROFILE_START(PROFILE_REPORT);
+    matrix_rows_t keys[NUM_COLS];
+    combo_process(matrix_state, keys);
+    report_update(keys);
+    PROFILE_END(PROFILE_REPORT);
+}
+
+typedef void (*task_function_t)();
+
+static const task_function_t task_functions[NUM_TASKS] PROGMEM = {
+    [TASK_SCAN] = scan_task,
+    [TASK_REPORT] = report_task,
+    [TASK_LEDS] = leds_task,
+    [TASK_HOUSEKEEPING] = key_stats_task,
+    [TASK_RGB] = rgb_task,
+    [TASK_PS2] = ps2_task,
+};
+
+uint16_t task_periods[NUM_TASKS] = {
+    [TASK_SCAN] = 0,
+    [TASK_REPORT] = 0,
+    [TASK_LEDS] = 5,
+    [TASK_HOUSEKEEPING] = 10,
+    [TASK_RGB] = RGB_FRAME_MS,
+    [TASK_PS2] = 1,
+};
+
+task_stats_t task_stats[NUM_TASKS];
+static volatile uint16_t deadlines[NUM_TASKS];
+static volatile uint8_t suspended = 0;
+
+void sched_init() {
+    const uint16_t now = timer_millis();
+    for (uint8_t i = 0; i < NUM_TASKS; i++) {
+        deadlines[i] = now;
+    }
+    // The tasks of the features left out would still wake the CPU (and with
+    // CLOCK_SCALING bring back the full clock) on every period
+#if !RGB_LEDS
+    sched_suspend(TASK_RGB);
+#endif
+#if !PS2_MOUSE
+    sched_suspend(TASK_PS2);
+#endif
+    sched_reset_stats();
+}
+
+void sched_suspend(uint8_t task) {
+    suspended |= (1 << task);
+}
+
+void sched_resume(uint8_t task) {
+    deadlines[task] = timer_millis();
+    suspended &= ~(1 << task);
+}
+
+void sched_reset_stats() {
+    for (uint8_t i = 0; i < NUM_TASKS; i++) {
+        task_stats[i].last = 0;
+        task_stats[i].max = 0;
+        task_stats[i].avg = 0;
+    }
+}
+
+static void run_task(uint8_t task, uint16_t now) {
+    const task_function_t function =
+        (task_function_t)pgm_read_ptr(&task_functions[task]);
+
+    const uint16_t start = timer_cycles();
+    function();
+    const uint16_t cycles = timer_cycles() - start;
+
+    task_stats_t *stats = &task_stats[task];
+    stats->last = cycles;
+    if (cycles > stats->max) {
+        stats->max = cycles;
+    }
+    stats->avg = stats->avg - (stats->avg >> 3) + (cycles >> 3);
+
+    deadlines[task] = now + task_periods[task];
+}
+
+#if SCAN_SOF_LOCK
+// Keeps the ms tick, and with it the start of the scan, just far enough
+// ahead of the SOF for the scan and the report to finish
+static void lock_to_sof() {
+#if SCAN_SOF_LEAD_US
+    timer_set_sof_lead(SCAN_SOF_LEAD_US * CYCLES_PER_US);
+#else
+    const uint32_t lead = (uint32_t)task_stats[TASK_SCAN].avg +
+                          task_stats[TASK_REPORT].avg +
+                          SCAN_SOF_MARGIN_US * CYCLES_PER_US;
+    timer_set_sof_lead(lead > UINT16_MAX ? UINT16_MAX : lead);
+#endif
+}
+#endif
+
+void sched_run() {
+    const uint16_t now = timer_millis();
+    const uint8_t was_suspended = suspended;
+    uint8_t done = was_suspended;
+
+    while (true) {
+        // Pick the due task with the earliest deadline
+        int8_t next = -1;
+        int16_t latest = -1;
+        for (uint8_t i = 0; i < NUM_TASKS; i++) {
+            const int16_t late = (int16_t)(now - deadlines[i]);
+            if (!(done & (1 << i)) && late > latest) {
+                next = i;
+                latest = late;
+            }
+        }
+        if (next < 0) {
+            break;
+        }
+
+        done |= (1 << next);
+        run_task(next, now);
+    }
+#if SCAN_SOF_LOCK
+    lock_to_sof();
+#endif
+
+    // Sleep until the next interrupt (at the latest the next ms tick) unless
+    // a task runs on every pass
+    for (uint8_t i = 0; i < NUM_TASKS; i++) {
+        if (task_periods[i] == 0 && !(suspended & (1 << i))) {
+            return;
+        }
+    }
+    set_sleep_mode(SLEEP_MODE_IDLE);
+    cli();
+    // A task resumed by an interrupt since we started has to run first
+    if ((uint16_t)timer_millis() == now && suspended == was_suspended) {
+#if CLOCK_SCALING
+        // Nothing is scanned until the pin change wakeup (the only reason
+        // for the scan to be suspended), the interrupts can make do with the
+        // slow clock
+        if (suspended & (1 << TASK_SCAN)) {
+            timer_clock_slow();
+        }
+#endif
+        sleep_enable();
+        sei();  // The instruction after sei is always executed, so no
+                // interrupt can sneak in before we go to sleep
+        sleep_cpu();
+        sleep_disable();
+    }
+    sei();
+#if CLOCK_SCALING
+    timer_clock_full();
+#endif
+}
@@ -0,0 +1,37 @@
+#ifndef SCHED_H
+#define SCHED_H
+#include <stdint.h>
+
+// Cooperative scheduler. Every task has a period in ms and runs once it is
+// due, due tasks run in the order of their deadlines. A period of 0 means the
+// task runs on every pass of the main loop.
+
+enum TASK {
+    TASK_SCAN,          // Matrix scan and debounce
+    TASK_REPORT,        // Combos and report building
+    TASK_LEDS,          // Lock indicator LEDs
+    TASK_HOUSEKEEPING,  // Saving the key stats
+    TASK_RGB,           // Per-key RGB lighting
+    TASK_PS2,           // PS/2 mouse setup
+    NUM_TASKS,
+};
+
+// Execution time of a task in CPU cycles, avg is a moving average over ~8 runs
+typedef struct {
+    uint16_t last;
+    uint16_t max;
+    uint16_t avg;
+} task_stats_t;
+
+extern uint16_t task_periods[NUM_TASKS];
+extern task_stats_t task_stats[NUM_TASKS];
+
+void sched_init();
+void sched_run();
+void sched_reset_stats();
+// A suspended task does not run until it is resumed, resuming (which is safe
+// from an interrupt) makes it due right away
+void sched_suspend(uint8_t task);
+void sched_resume(uint8_t task);
+
+#endif
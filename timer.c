@@ -0,0 +1,131 @@
+#include "timer.h"
+
+#include <avr/interrupt.h>
+#include <avr/power.h>
+#include <stdbool.h>
+#include <util/atomic.h>
+
+#include "board.h"
+
+// Timer0 counts at F_CPU / 64 and wraps every millisecond
+#define TIMER0_TOP ((F_CPU / 64 / 1000) - 1)
+// Where Timer0 is put on every SOF by default. The tick then lands half a
+// frame after the SOF, so small clock differences to the host never make it
+// skip or repeat.
+#define TIMER0_SOF_PHASE ((TIMER0_TOP + 1) / 2)
+// A tick closer to the SOF than this could skip or repeat
+#define TIMER0_MIN_LEAD 2
+
+static volatile uint32_t timer_overflows = 0;
+static volatile uint32_t timer_ms = 0;
+static volatile uint8_t timer0_sof_phase = TIMER0_SOF_PHASE;
+
+#if CLOCK_SCALING
+static volatile bool timer_slow = false;
+static uint64_t timer_slow_since;
+// Timer1 counts 8 times slower on the slow clock, the cycles it missed are
+// added back to keep timer_now() in real time
+static uint64_t timer_lost_cycles = 0;
+#endif
+
+void timer_init() {
+    TCCR1A = 0;             // Normal mode, no output compare pins
+    TCCR1B = (1 << CS10);   // No prescaler, count CPU cycles
+    TCNT1 = 0;
+    TIMSK1 = (1 << TOIE1);  // Count the overflows to extend the counter
+
+    TCCR0A = (1 << WGM01);               // CTC mode, TOP = OCR0A
+    TCCR0B = (1 << CS01) | (1 << CS00);  // Prescaler 64
+    OCR0A = TIMER0_TOP;
+    TCNT0 = 0;
+    TIMSK0 = (1 << OCIE0A);
+}
+
+ISR(TIMER1_OVF_vect) {
+    timer_overflows++;
+}
+
+ISR(TIMER0_COMPA_vect) {
+    timer_ms++;
+}
+
+uint32_t timer_millis() {
+    uint32_t value;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) { value = timer_ms; }
+    return value;
+}
+
+void timer_sync_to_sof() {
+    TCNT0 = timer0_sof_phase;
+}
+
+void timer_set_sof_lead(uint16_t cycles) {
+    // Timer0 counts every 64 cycles, rounded up without overflowing
+    uint16_t steps = cycles / 64 + ((cycles & 63) != 0);
+    if (steps < TIMER0_MIN_LEAD) {
+        steps = TIMER0_MIN_LEAD;
+    } else if (steps > TIMER0_TOP + 1 - TIMER0_SOF_PHASE) {
+        steps = TIMER0_TOP + 1 - TIMER0_SOF_PHASE;
+    }
+    // Timer0 starts at `steps` on the SOF and reaches the compare match
+    // TOP + 1 - steps counts later, which is `steps` before the next SOF
+    timer0_sof_phase = steps;
+}
+
+static uint64_t timer_raw() {
+    uint32_t high;
+    uint16_t low;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        high = timer_overflows;
+        low = TCNT1;
+        // The counter overflowed after the interrupts were disabled, the
+        // overflow interrupt did not have a chance to run yet
+        if ((TIFR1 & (1 << TOV1)) && low < 0x8000) {
+            high++;
+        }
+    }
+    return ((uint64_t)high << 16) | low;
+}
+
+static uint64_t timer_now_extended() {
+#if CLOCK_SCALING
+    uint64_t value;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        value = timer_raw() + timer_lost_cycles;
+    }
+    return value;
+#else
+    return timer_raw();
+#endif
+}
+
+#if CLOCK_SCALING
+void timer_clock_slow() {
+    if (timer_slow) {
+        return;
+    }
+    timer_slow_since = timer_raw();
+    clock_prescale_set(clock_div_8);
+    TCCR0B = (1 << CS01);  // Prescaler 8, Timer0 keeps counting at 250khz
+    timer_slow = true;
+}
+
+void timer_clock_full() {
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        if (timer_slow) {
+            clock_prescale_set(clock_div_1);
+            TCCR0B = (1 << CS01) | (1 << CS00);  // Prescaler 64
+            timer_lost_cycles += (timer_raw() - timer_slow_since) * 7;
+            timer_slow = false;
+        }
+    }
+}
+#endif
+
+uint32_t timer_now() {
+    return (uint32_t)timer_now_extended();
+}
+
+uint32_t timer_now_us() {
+    return (uint32_t)(timer_now_extended() / CYCLES_PER_US);
+}
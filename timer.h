@@ -0,0 +1,42 @@
+#ifndef TIMER_H
+#define TIMER_H
+#include <avr/io.h>
+#include <stdint.h>
+
+#define CYCLES_PER_US (F_CPU / 1000000UL)
+
+void timer_init();
+// Time since timer_init() in cycles, extended to 32 bits with the overflow
+// count (wraps after ~268s at 16mhz)
+uint32_t timer_now();
+// Time since timer_init() in microseconds (wraps after ~71 minutes)
+uint32_t timer_now_us();
+// Millisecond clock driven by Timer0, runs from reset and is kept in phase
+// with the USB frames once the host sends SOFs
+uint32_t timer_millis();
+// Called on every SOF to align the millisecond tick with the frame
+void timer_sync_to_sof();
+// Divide the CPU clock by 8 and go back to F_CPU. The millisecond clock and
+// timer_now() stay correct, timer_cycles() counts the slower cycles. Slowing
+// down needs the interrupts disabled, both are no-ops in the requested state.
+void timer_clock_slow();
+void timer_clock_full();
+// Moves the millisecond tick to `cycles` before the next SOF (at least 2 and
+// at most half a frame's worth of Timer0 steps)
+void timer_set_sof_lead(uint16_t cycles);
+
+// Timer1 runs free at the CPU clock, so this is a cycle counter which wraps
+// every 65536 cycles (~4ms at 16mhz). Use unsigned differences to measure
+// intervals.
+__attribute__((always_inline, warn_unused_result)) static inline uint16_t
+timer_cycles() {
+    return TCNT1;
+}
+
+__attribute__((always_inline)) static inline void timer_wait_since(
+    uint16_t start, uint16_t cycles) {
+    while ((uint16_t)(timer_cycles() - start) < cycles)
+        ;
+}
+
+#endif
@@ -0,0 +1,126 @@
+#include "twi.h"
+
+#include <avr/interrupt.h>
+#include <avr/io.h>
+#include <util/atomic.h>
+
+#include "board.h"
+
+// Must be a power of two
+#define TWI_QUEUE_SIZE 4
+
+// TWSR status codes (prescaler bits masked), atmega32u4 datasheet table 20-3
+// and table 20-4
+#define TW_START 0x08
+#define TW_REP_START 0x10
+#define TW_MT_SLA_ACK 0x18
+#define TW_MT_DATA_ACK 0x28
+#define TW_MR_SLA_ACK 0x40
+#define TW_MR_DATA_ACK 0x50
+#define TW_MR_DATA_NACK 0x58
+
+#define TWCR_START ((1 << TWINT) | (1 << TWSTA) | (1 << TWEN) | (1 << TWIE))
+#define TWCR_STOP ((1 << TWINT) | (1 << TWSTO) | (1 << TWEN) | (1 << TWIE))
+// Goes on with the transfer, acknowledging a received byte
+#define TWCR_ACK ((1 << TWINT) | (1 << TWEA) | (1 << TWEN) | (1 << TWIE))
+// Goes on with the transfer, a received byte is not acknowledged
+#define TWCR_NEXT ((1 << TWINT) | (1 << TWEN) | (1 << TWIE))
+
+static twi_transaction_t *queue[TWI_QUEUE_SIZE];
+static volatile uint8_t queue_head = 0;  // Running transaction
+static volatile uint8_t queue_tail = 0;
+static volatile bool busy = false;
+
+// Progress of the running transaction
+static uint8_t written;
+static uint8_t received;
+
+void twi_init() {
+    TWSR = 0;  // Prescaler 1
+    TWBR = ((F_CPU / TWI_FREQ) - 16) / 2;
+    TWCR = (1 << TWEN);
+}
+
+bool twi_queue(twi_transaction_t *transaction) {
+    bool queued = false;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        if ((uint8_t)(queue_tail - queue_head) < TWI_QUEUE_SIZE) {
+            queue[queue_tail++ & (TWI_QUEUE_SIZE - 1)] = transaction;
+            queued = true;
+            if (!busy) {
+                busy = true;
+                written = 0;
+                received = 0;
+                TWCR = TWCR_START;
+            }
+        }
+    }
+    return queued;
+}
+
+// Ends the running transaction with a STOP and starts the next one, the STOP
+// and the next START go out back to back
+static void finish(bool ok) {
+    twi_transaction_t *transaction = queue[queue_head & (TWI_QUEUE_SIZE - 1)];
+    queue_head++;
+    // May queue a new transaction, which then finds the bus still busy
+    transaction->done(transaction, ok);
+
+    written = 0;
+    received = 0;
+    if (queue_head != queue_tail) {
+        TWCR = TWCR_STOP | (1 << TWSTA);
+    } else {
+        busy = false;
+        TWCR = TWCR_STOP & ~(1 << TWIE);
+    }
+}
+
+ISR(TWI_vect) {
+    twi_transaction_t *transaction = queue[queue_head & (TWI_QUEUE_SIZE - 1)];
+
+    switch (TWSR & 0xF8) {
+        case TW_START:
+        case TW_REP_START:
+            if (written < transaction->write_length) {
+                TWDR = transaction->address << 1;  // Write
+            } else {
+                TWDR = (transaction->address << 1) | 1;  // Read
+            }
+            TWCR = TWCR_NEXT;
+            break;
+
+        case TW_MT_SLA_ACK:
+        case TW_MT_DATA_ACK:
+            if (written < transaction->write_length) {
+                TWDR = transaction->write[written++];
+                TWCR = TWCR_NEXT;
+            } else if (transaction->read_length > 0) {
+                TWCR = TWCR_START;  // Repeated START for the read
+            } else {
+                finish(true);
+            }
+            break;
+
+        case TW_MR_SLA_ACK:
+            // Acknowledge every byte but the last one
+            TWCR = transaction->read_length > 1 ? TWCR_ACK : TWCR_NEXT;
+            break;
+
+        case TW_MR_DATA_ACK:
+            transaction->read[received++] = TWDR;
+            TWCR = received + 1 < transaction->read_length ? TWCR_ACK
+                                                            : TWCR_NEXT;
+            break;
+
+        case TW_MR_DATA_NACK:
+            transaction->read[received++] = TWDR;
+            finish(true);
+            break;
+
+        default:
+            // Address or data not acknowledged, or arbitration lost
+            finish(false);
+            break;
+    }
+}
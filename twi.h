@@ -0,0 +1,32 @@
+#ifndef TWI_H
+#define TWI_H
+#include <stdbool.h>
+#include <stdint.h>
+
+// Interrupt driven TWI (I2C) master. Transactions are queued and run one
+// after the other from the TWI interrupt, so nothing ever waits for the bus.
+
+typedef struct twi_transaction twi_transaction_t;
+
+// Called from the TWI interrupt once the transaction is over, ok is false if
+// the slave did not acknowledge (or the bus was lost). The transaction may be
+// queued again from here.
+typedef void (*twi_callback_t)(twi_transaction_t *transaction, bool ok);
+
+// Writes write_length bytes and then, after a repeated START, reads
+// read_length bytes. Either part may be empty. The transaction and its
+// buffers belong to the caller and must stay untouched until the callback.
+struct twi_transaction {
+    uint8_t address;  // 7-bit slave address
+    uint8_t write_length;
+    uint8_t read_length;
+    const uint8_t *write;
+    uint8_t *read;
+    twi_callback_t done;
+};
+
+void twi_init();
+// Returns false if the queue is full
+bool twi_queue(twi_transaction_t *transaction);
+
+#endif